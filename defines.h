@@ -7,7 +7,15 @@
 #define CMD_MAX_LEN 4096
 #define MAX_PATH 260
 #define NATIVE_MESSAGE_MAX_LEN 1000000
+#define NATIVE_MESSAGE_IN_MAX_LEN (64*1024*1024)
 
+//how often the progress of each download is sent to the extension
+#define PROGRESS_INTERVAL_MS 1000
+
+//how much of the output of a download is kept to report why it failed
+#define OUTPUT_TAIL_LEN (64*1024)
+
+#define YTDL_EXE "./yt-dlp"
 #define YTDL_CANCEL_CODE 3221225786
 
 //message types
@@ -33,3 +41,4 @@
 #define MSGTYP_MSG "app_message"
 #define MSGTYP_ERR_GUI "app_error_gui"
 #define MSGTYP_UNSUPP "unsupported"
+#define MSGTYP_CHUNK "chunk"
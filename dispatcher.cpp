@@ -0,0 +1,178 @@
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <plog/Log.h>
+#include "dispatcher.h"
+#include "exceptions.h"
+#include "messaging.h"
+#include "task_pool.h"
+#include "defines.h"
+
+using namespace std;
+using namespace ggicci;
+
+struct msg_entry;
+static void extractFields(const Json &msg, msg_entry &entry, msg_fields &fields);
+static void runHandler(const Json &msg, const msg_fields &fields, msg_entry &entry);
+
+struct msg_entry
+{
+	string type;
+	vector<string> fields;
+	vector<bool> optional;
+	msg_handler handler;
+	bool pooled;
+	std::atomic<unsigned long> calls;
+	std::atomic<unsigned long long> dispatchNs;
+	std::atomic<unsigned long long> handlerNs;
+};
+
+//indexed by message type id, filled before the event loop starts
+msg_entry msgHandlers[MSGTYPE_SLOTS];
+
+dispatcher::dispatcher(void)
+{
+}
+
+dispatcher::~dispatcher(void)
+{
+}
+
+//pooled handlers run on the task pool, one at a time for each dlHash, so a slow one doesn't hold up the rest
+void dispatcher::add(const char *type, const vector<string> &fields, msg_handler handler, bool pooled)
+{
+	msg_entry &entry = msgHandlers[msgtype_id(type)];
+
+	if(entry.handler && entry.type != type)
+	{
+		string msg = string("message type ") + type + " collides with " + entry.type;
+		throw fatal_exception(msg.c_str());
+	}
+
+	entry.type = type;
+	entry.fields.clear();
+	entry.optional.clear();
+	entry.handler = handler;
+	entry.pooled = pooled;
+	entry.calls = 0;
+	entry.dispatchNs = 0;
+	entry.handlerNs = 0;
+
+	for(size_t i=0; i<fields.size(); i++)
+	{
+		bool optional = (fields[i].length() > 0 && fields[i][0] == '?');
+		entry.fields.push_back(optional? fields[i].substr(1) : fields[i]);
+		entry.optional.push_back(optional);
+	}
+}
+
+void dispatcher::add(const msg_route &route)
+{
+	vector<string> fields;
+	for(int i=0; i<MSG_ROUTE_FIELDS && route.fields[i] != NULL; i++)
+	{
+		fields.push_back(route.fields[i]);
+	}
+	add(route.type, fields, route.handler, route.pooled);
+}
+
+//returns false if there is no handler for the type of the message
+bool dispatcher::dispatch(const Json &msg)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	if(!msg.IsObject() || !msg.Contains("type"))
+	{
+		throw grb_exception("message has no type");
+	}
+
+	string type = msg["type"].AsString();
+	//the same function the ids were checked for collisions with at compile time
+	//a type with a NUL in it can land on a handler but then doesn't match its type
+	msg_entry &entry = msgHandlers[msgtype_id(type.c_str())];
+
+	if(!entry.handler || entry.type != type)
+	{
+		return false;
+	}
+
+	msg_fields fields;
+	extractFields(msg, entry, fields);
+
+	chrono::steady_clock::time_point dispatched = chrono::steady_clock::now();
+	entry.dispatchNs += chrono::duration_cast<chrono::nanoseconds>(dispatched - start).count();
+
+	if(!entry.pooled)
+	{
+		runHandler(msg, fields, entry);
+		return true;
+	}
+
+	//the message and the fields are only valid during this call so the pooled handler gets its own copy
+	shared_ptr<Json> copy = make_shared<Json>(msg);
+	string key = (copy->Contains("dlHash") && (*copy)["dlHash"].IsString())? (*copy)["dlHash"].AsString() : "";
+
+	task_pool::run(key, [copy, &entry](){
+		msg_fields fields;
+
+		try
+		{
+			extractFields(*copy, entry, fields);
+			runHandler(*copy, fields, entry);
+		}
+		catch(exception &e)
+		{
+			try{
+				messaging::sendMessage(MSGTYP_ERR, e.what(), fields.requestId);
+				PLOG_ERROR << e.what();
+			}catch(...){}
+		}
+		catch(...){}	//ain't nothing we can do if we're here
+	});
+
+	return true;
+}
+
+//look up every field the handler needs exactly once
+static void extractFields(const Json &msg, msg_entry &entry, msg_fields &fields)
+{
+	if(msg.Contains("requestId"))
+	{
+		fields.requestId = msg["requestId"];
+	}
+
+	fields.values.reserve(entry.fields.size());
+	for(size_t i=0; i<entry.fields.size(); i++)
+	{
+		const char *name = entry.fields[i].c_str();
+
+		if(msg.Contains(name))
+		{
+			fields.values.push_back(&msg[name]);
+		}
+		else if(entry.optional[i])
+		{
+			fields.values.push_back(NULL);
+		}
+		else
+		{
+			string err = "message " + entry.type + " is missing field " + entry.fields[i];
+			throw grb_exception(err.c_str());
+		}
+	}
+}
+
+static void runHandler(const Json &msg, const msg_fields &fields, msg_entry &entry)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	entry.handler(msg, fields);
+
+	chrono::steady_clock::time_point handled = chrono::steady_clock::now();
+
+	unsigned long calls = ++entry.calls;
+	entry.handlerNs += chrono::duration_cast<chrono::nanoseconds>(handled - start).count();
+
+	PLOG_DEBUG << "dispatched " << entry.type << " - average dispatch: " << entry.dispatchNs / calls
+			<< "ns - average handler: " << entry.handlerNs / calls << "ns";
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include "jsonla.h"
+
+//FNV-1a, constexpr so the id of a message type is known at compile time
+constexpr uint32_t msgtype_hash(const char *type, uint32_t hash = 2166136261u)
+{
+	return (*type == '\0')? hash : msgtype_hash(type + 1, (hash ^ (uint8_t)*type) * 16777619u);
+}
+
+const int MSGTYPE_SLOTS = 64;
+
+//the types we handle must all get different ids, a table of msg_routes can be checked with msg_routes_distinct()
+constexpr int msgtype_id(const char *type)
+{
+	return msgtype_hash(type) % MSGTYPE_SLOTS;
+}
+
+//the fields a handler declared, in the order it declared them
+//optional fields (declared with a leading '?') are NULL when the message doesn't have them
+//requestId is the optional id the extension gave the request, it is null if there isn't one
+struct msg_fields
+{
+	std::vector<const ggicci::Json*> values;
+	ggicci::Json requestId;
+
+	const ggicci::Json* operator[](int i) const { return values[i]; }
+};
+
+typedef std::function<void(const ggicci::Json &msg, const msg_fields &fields)> msg_handler;
+
+const int MSG_ROUTE_FIELDS = 8;
+
+//a row of the constexpr table of the handlers a module registers, so their ids can be checked at compile time
+//fields are declared as in dispatcher::add() and end at the first NULL
+struct msg_route
+{
+	const char *type;
+	const char *fields[MSG_ROUTE_FIELDS];
+	void (*handler)(const ggicci::Json &msg, const msg_fields &fields);
+	bool pooled = false;
+};
+
+template<size_t N>
+constexpr bool msg_routes_distinct(const msg_route (&routes)[N])
+{
+	for(size_t i=0; i<N; i++)
+	{
+		for(size_t j=i+1; j<N; j++)
+		{
+			if(msgtype_id(routes[i].type) == msgtype_id(routes[j].type)) return false;
+		}
+	}
+	return true;
+}
+
+class dispatcher
+{
+
+public:
+	dispatcher(void);
+	~dispatcher(void);
+	static void add(const char *type, const std::vector<std::string> &fields, msg_handler handler, bool pooled = false);
+	static void add(const msg_route &route);
+	static bool dispatch(const ggicci::Json &msg);
+};
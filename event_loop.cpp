@@ -0,0 +1,259 @@
+#include <mutex>
+#include <map>
+#include <vector>
+#include <thread>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <plog/Log.h>
+#include "event_loop.h"
+#include "exceptions.h"
+
+using namespace std;
+
+struct loop_timer
+{
+	long long due;
+	int interval;
+	bool repeat;
+	loop_task task;
+};
+
+std::mutex elMutex;
+int epollFd = -1;
+int wakeFd = -1;
+int lastTimerId = 0;
+map<int, fd_handler> fdHandlers;
+map<int, loop_timer> loopTimers;
+vector<loop_task> postedTasks;
+std::thread::id loopThreadId;
+
+
+static long long nowMs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void wakeUp()
+{
+	uint64_t one = 1;
+	if(write(wakeFd, &one, sizeof(one)) != sizeof(one))
+	{
+		PLOG_ERROR << "failed to wake up event loop - errno: " << errno;
+	}
+}
+
+//runs the tasks in order, if one of them throws the ones after it go back to the front of the posted tasks
+//so they still run once run() is called again, one-shot timers in the batch have already been removed
+static void runTasks(vector<loop_task> &tasks)
+{
+	for(size_t i=0; i<tasks.size(); i++)
+	{
+		try
+		{
+			tasks[i]();
+		}
+		catch(...)
+		{
+			std::lock_guard<std::mutex> lock(elMutex);
+			postedTasks.insert(postedTasks.begin(), tasks.begin() + i + 1, tasks.end());
+			throw;
+		}
+	}
+}
+
+eventloop::eventloop(void)
+{
+}
+
+eventloop::~eventloop(void)
+{
+}
+
+void eventloop::init()
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if(epollFd == -1 || wakeFd == -1)
+	{
+		throw fatal_exception("could not create event loop");
+	}
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = wakeFd;
+	if(epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev) != 0)
+	{
+		throw fatal_exception("could not add wakeup fd to event loop");
+	}
+}
+
+//runs the reactor until an exception escapes one of the handlers
+//the caller is expected to call run() again after handling the exception
+void eventloop::run()
+{
+	loopThreadId = this_thread::get_id();
+
+	const int MAX_EVENTS = 64;
+	epoll_event events[MAX_EVENTS];
+
+	while(true)
+	{
+		//sleep until an fd is ready or the nearest timer is due
+		int timeout = -1;
+		{
+			std::lock_guard<std::mutex> lock(elMutex);
+			if(postedTasks.size() > 0)
+			{
+				timeout = 0;
+			}
+			for(map<int, loop_timer>::iterator it = loopTimers.begin(); it != loopTimers.end(); ++it)
+			{
+				long long left = it->second.due - nowMs();
+				if(left < 0) left = 0;
+				if(timeout == -1 || left < timeout) timeout = (int)left;
+			}
+		}
+
+		int n = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+
+		if(n == -1)
+		{
+			if(errno == EINTR) continue;
+			throw fatal_exception("epoll_wait failed");
+		}
+
+		for(int i=0; i<n; i++)
+		{
+			int fd = events[i].data.fd;
+
+			if(fd == wakeFd)
+			{
+				uint64_t count;
+				while(read(wakeFd, &count, sizeof(count)) > 0){}
+				continue;
+			}
+
+			//copy the handler because it is allowed to unwatch its own fd
+			fd_handler handler;
+			{
+				std::lock_guard<std::mutex> lock(elMutex);
+				map<int, fd_handler>::iterator it = fdHandlers.find(fd);
+				if(it == fdHandlers.end()) continue;
+				handler = it->second;
+			}
+
+			handler(events[i].events);
+		}
+
+		//run tasks posted from other threads
+		vector<loop_task> tasks;
+		{
+			std::lock_guard<std::mutex> lock(elMutex);
+			tasks.swap(postedTasks);
+		}
+		runTasks(tasks);
+
+		//run due timers
+		vector<loop_task> due;
+		{
+			std::lock_guard<std::mutex> lock(elMutex);
+			long long now = nowMs();
+			map<int, loop_timer>::iterator it = loopTimers.begin();
+			while(it != loopTimers.end())
+			{
+				if(it->second.due > now)
+				{
+					++it;
+					continue;
+				}
+
+				due.push_back(it->second.task);
+
+				if(it->second.repeat)
+				{
+					it->second.due = now + it->second.interval;
+					++it;
+				}
+				else
+				{
+					it = loopTimers.erase(it);
+				}
+			}
+		}
+		runTasks(due);
+	}
+}
+
+void eventloop::watchFd(int fd, uint32_t events, fd_handler handler)
+{
+	{
+		std::lock_guard<std::mutex> lock(elMutex);
+		fdHandlers[fd] = handler;
+	}
+
+	epoll_event ev = {};
+	ev.events = events;
+	ev.data.fd = fd;
+	if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		std::lock_guard<std::mutex> lock(elMutex);
+		fdHandlers.erase(fd);
+		string msg = "could not watch fd - errno: " + to_string(errno);
+		throw grb_exception(msg.c_str());
+	}
+}
+
+//must be called before the fd is closed
+void eventloop::unwatchFd(int fd)
+{
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+	std::lock_guard<std::mutex> lock(elMutex);
+	fdHandlers.erase(fd);
+}
+
+int eventloop::addTimer(int intervalMs, bool repeat, loop_task task)
+{
+	int timerId;
+	{
+		std::lock_guard<std::mutex> lock(elMutex);
+		timerId = ++lastTimerId;
+		loop_timer timer;
+		timer.due = nowMs() + intervalMs;
+		timer.interval = intervalMs;
+		timer.repeat = repeat;
+		timer.task = task;
+		loopTimers[timerId] = timer;
+	}
+
+	//so that the loop recalculates its timeout
+	if(!isLoopThread()) wakeUp();
+
+	return timerId;
+}
+
+void eventloop::cancelTimer(int timerId)
+{
+	std::lock_guard<std::mutex> lock(elMutex);
+	loopTimers.erase(timerId);
+}
+
+//thread-safe, the task runs on the loop thread
+void eventloop::post(loop_task task)
+{
+	{
+		std::lock_guard<std::mutex> lock(elMutex);
+		postedTasks.push_back(task);
+	}
+	wakeUp();
+}
+
+bool eventloop::isLoopThread()
+{
+	return this_thread::get_id() == loopThreadId;
+}
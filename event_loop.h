@@ -0,0 +1,25 @@
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+
+typedef std::function<void(uint32_t events)> fd_handler;
+typedef std::function<void()> loop_task;
+
+//a single epoll reactor that owns stdin, the child process pipes and the timers
+//everything registered here runs on the thread that called run()
+class eventloop
+{
+
+public:
+	eventloop(void);
+	~eventloop(void);
+	static void init();
+	static void run();
+	static void watchFd(int fd, uint32_t events, fd_handler handler);
+	static void unwatchFd(int fd);
+	static int addTimer(int intervalMs, bool repeat, loop_task task);
+	static void cancelTimer(int timerId);
+	static void post(loop_task task);
+	static bool isLoopThread();
+};
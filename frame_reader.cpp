@@ -0,0 +1,137 @@
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include "frame_reader.h"
+#include "exceptions.h"
+
+using namespace std;
+
+const size_t READ_CHUNK = 64 * 1024;
+
+frame_reader::frame_reader(int fd, size_t maxFrameSize) : fd(fd), maxFrameSize(maxFrameSize),
+		start(0), end(0), nulPos(0), savedByte(0), hasNul(false)
+{
+	buffer.resize(READ_CHUNK + 1);
+}
+
+frame_reader::~frame_reader(void)
+{
+}
+
+//put back the byte that was overwritten to terminate the last frame
+void frame_reader::restore()
+{
+	if(hasNul)
+	{
+		buffer[nulPos] = savedByte;
+		hasNul = false;
+	}
+}
+
+//make sure there is room for reading at least 'need' bytes plus the terminating NUL
+void frame_reader::makeRoom(size_t need)
+{
+	if(buffer.size() - 1 - end >= need)
+	{
+		return;
+	}
+
+	//move the unconsumed bytes to the beginning of the buffer
+	if(start > 0)
+	{
+		memmove(buffer.data(), buffer.data() + start, end - start);
+		end -= start;
+		start = 0;
+	}
+
+	if(buffer.size() - 1 - end < need)
+	{
+		buffer.resize(end + need + 1);
+	}
+}
+
+//does a single read() on the fd, returns false on EOF
+//the caller is expected to take all complete frames out with next() before calling this again
+bool frame_reader::fill()
+{
+	restore();
+
+	if(start == end)
+	{
+		start = end = 0;
+	}
+
+	//if we know the length of the pending frame read all of it at once
+	size_t need = READ_CHUNK;
+	if(end - start >= 4)
+	{
+		uint32_t length;
+		memcpy(&length, buffer.data() + start, 4);
+		if(length <= maxFrameSize && 4 + length > end - start)
+		{
+			need = max(need, 4 + length - (end - start));
+		}
+	}
+
+	makeRoom(need);
+
+	while(true)
+	{
+		ssize_t bytes_read = read(fd, buffer.data() + end, buffer.size() - 1 - end);
+
+		if(bytes_read > 0)
+		{
+			end += bytes_read;
+			return true;
+		}
+
+		if(bytes_read == 0)
+		{
+			return false;
+		}
+
+		if(errno == EINTR) continue;
+		if(errno == EAGAIN || errno == EWOULDBLOCK) return true;
+
+		string msg = "Error reading from stdin - errno: " + to_string(errno);
+		throw fatal_exception(msg.c_str());
+	}
+}
+
+//takes the next complete frame out of the buffer, returns false if there isn't one yet
+bool frame_reader::next(string_view &frame)
+{
+	restore();
+
+	if(end - start < 4)
+	{
+		return false;
+	}
+
+	uint32_t length;
+	memcpy(&length, buffer.data() + start, 4);
+
+	//we can't find the start of the next frame after a bad length so this is fatal
+	if(length == 0 || length > maxFrameSize)
+	{
+		string msg = "Error reading message length: bad message length " + to_string(length);
+		throw fatal_exception(msg.c_str());
+	}
+
+	if(end - start - 4 < length)
+	{
+		return false;
+	}
+
+	nulPos = start + 4 + length;
+	savedByte = buffer[nulPos];
+	buffer[nulPos] = '\0';
+	hasNul = true;
+
+	frame = string_view(buffer.data() + start + 4, length);
+	start += 4 + length;
+
+	return true;
+}
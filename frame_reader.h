@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <stddef.h>
+
+//reads length-prefixed native messaging frames from an fd into one reusable buffer
+//frames are handed out as views into the buffer and stay valid until the next call to fill() or next()
+//each frame is followed by a NUL so it can be passed to the JSON parser as-is
+class frame_reader
+{
+	private:
+	int fd;
+	size_t maxFrameSize;
+	std::vector<char> buffer;
+	size_t start;
+	size_t end;
+	size_t nulPos;
+	char savedByte;
+	bool hasNul;
+
+	void restore();
+	void makeRoom(size_t need);
+
+	public:
+	frame_reader(int fd, size_t maxFrameSize);
+	~frame_reader(void);
+	bool fill();
+	bool next(std::string_view &frame);
+};
@@ -6,16 +6,19 @@
 //TODO: change main to int _tmain(int argc, TCHAR *argv[]) in flashgot too
 
 //policies
-//nothing is allowed to consume an exception except for main()
+//nothing is allowed to consume an exception except for main() and the message loop
 //if a function wants to catch an exception it must rethrow it
 //except for main functions of threads, they MUST consume their own exception
 //all thread main function names should end with _th
 //all thread main functions should have their whole body enclosed in a try-catch
+//the same goes for functions called when a process exits, their names end with _done
 
 #include <iostream>
 #include <fstream>
 #include <fcntl.h>
 #include <thread>
+#include <memory>
+#include <sys/epoll.h>
 #include "grabby_native_app.h"
 #include "utils.h"
 #include "messaging.h"
@@ -24,7 +27,13 @@
 #include "defines.h"
 #include "base64.hpp"
 #include "kill_switches.h"
-#include <gzip/compress.hpp>
+#include "event_loop.h"
+#include "progress.h"
+#include "metrics.h"
+#include "dispatcher.h"
+#include "task_pool.h"
+#include "recorder.h"
+#include "playlist_stream.h"
 
 using namespace std;
 using namespace ggicci;
@@ -32,14 +41,24 @@ using namespace base64;
 
 string versionStr = "0.63.0";
 
+//big things in the video info that the extension doesn't use
+const JsonFilter infoFilter(JsonFilter::kDeny, {"automatic_captions", "subtitles", "categories",
+		"requested_formats", "tags", "description"});
+
 int main(int argc, char *argv[])
 {
 	//initializations
 	try{
 		plog::init(plog::debug, "log.txt", 1000*1000, 2);
+		recorder::init();
+		metrics::init();
 		freopen(NULL, "rb", stdin);
 		freopen(NULL, "wb", stdout);
 		utils::getTerminalCmd();
+		eventloop::init();
+		register_handlers();
+		fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+		eventloop::watchFd(STDIN_FILENO, EPOLLIN, on_stdin);
 	}
 	catch(exception &e)
 	{
@@ -47,6 +66,7 @@ int main(int argc, char *argv[])
 			messaging::sendMessage(MSGTYP_ERR, e.what());
 			PLOG_FATAL << e.what();
 		}catch(...){}
+		messaging::flush();
 		exit(EXIT_FAILURE);
 	}
 	//same just for unknown exceptions
@@ -56,22 +76,19 @@ int main(int argc, char *argv[])
 			messaging::sendMessage(MSGTYP_ERR, "A fatal error has occurred");
 			PLOG_FATAL << "A fatal error has occurred";
 		}catch(...){}
+		messaging::flush();
 		exit(EXIT_FAILURE);
 	}
 
 	PLOG_INFO << "starting native host";
 
 	//the loop for sending/receiving messages
+	//the event loop only returns when one of its handlers throws
     while(true)
 	{
 		try
 		{
-			string raw_message = messaging::get_message();
-
-			PLOG_INFO << "received message: " << raw_message;
-
-			Json msg = utils::parseJSON(raw_message);
-			processMessage(msg);
+			eventloop::run();
 		}
 		catch(fatal_exception &e)
 		{
@@ -79,6 +96,7 @@ int main(int argc, char *argv[])
 				messaging::sendMessage(MSGTYP_ERR, e.what());
 				PLOG_FATAL << e.what();
 			}catch(...){}
+			messaging::flush();
 			//we exit after a fatal exception because otherwise the infinite loop will run rapidly
 			exit(EXIT_FAILURE);
 		}
@@ -101,44 +119,100 @@ int main(int argc, char *argv[])
     }
 }
 
-//using the reference of the Json object because pass by value caused exception because of copy constructor error
-void processMessage(const Json &msg)
+//called by the event loop when stdin is readable
+void on_stdin(uint32_t events)
+{
+	bool open = messaging::readInput();
+
+	string_view raw_message;
+
+	while(messaging::nextMessage(raw_message))
+	{
+		recorder::inbound(raw_message);
+		process_raw_message(raw_message);
+	}
+
+	if(!open)
+	{
+		throw fatal_exception("Error reading message length: stdin was closed");
+	}
+}
+
+//the message loop consumes the exceptions of each message so that one bad message doesn't hold up the rest
+void process_raw_message(string_view raw_message)
 {
+	Json requestId;
+
 	try
 	{
-		string type = msg["type"].AsString();
+		PLOG_INFO << "received message: " << raw_message;
 
-		if(type == MSGTYP_GET_VERSION)
-		{
-			handle_getversion(msg);
-		}
-		else if(type == MSGTYP_GET_AVAIL_DMS)
-		{
-			handle_getavail(msg);
-		}
-		else if(type == MSGTYP_DOWNLOAD)
-		{
-			handle_download(msg);
-		}
-		else if(type == MSGTYP_USER_CMD)
-		{
-			handle_custom_cmd(msg);
-		}
-		else if(type == MSGTYP_YTDL_INFO)
-		{
-			handle_ytdlinfo(msg);
-		}
-		else if(type == MSGTYP_YTDL_GET)
-		{
-			handle_ytdlget(msg);
-		}
-		else if(type == MSGTYP_YTDL_KILL)
+		//the strings of the message point into the frame, which stays valid until we're done with it
+		Json msg = utils::parseJSONInSitu(raw_message);
+
+		if(msg.IsObject() && msg.Contains("requestId"))
 		{
-			handle_ytdlkill(msg);
+			requestId = msg["requestId"];
 		}
-		else
+
+		processMessage(msg);
+	}
+	catch(fatal_exception &e)
+	{
+		throw;
+	}
+	catch(exception &e)
+	{
+		try{
+			messaging::sendMessage(MSGTYP_ERR, e.what(), requestId);
+			PLOG_ERROR << e.what();
+		}catch(...){}
+	}
+	//same just for unknown exceptions
+	catch(...)
+	{
+		try{
+			messaging::sendMessage(MSGTYP_ERR, "An unknown error has occurred", requestId);
+			PLOG_ERROR << "An unknown error has occurred";
+		}catch(...){}
+	}
+}
+
+//each handler declares the fields it needs, optional ones start with '?'
+//handlers that don't need the event loop run on the task pool so they don't hold up other requests
+//work for a dlHash is only kept in order on the task pool, two handlers don't go through it:
+//ytdl_get waits on a thread of its own for the save dialog, which would hold a worker for as long as it is open,
+//and ytdl_kill runs as soon as it is read so a cancel isn't queued behind the work it cancels
+//a new message type only needs a row here, its id is checked for collisions at compile time
+constexpr msg_route msgRoutes[] = {
+	{MSGTYP_GET_VERSION, {}, handle_getversion, true},
+	{MSGTYP_GET_AVAIL_DMS, {}, handle_getavail, true},
+	{MSGTYP_DOWNLOAD, {}, handle_download},
+	{MSGTYP_USER_CMD, {"procName", "filename", "showConsole", "showSaveas", "args"}, handle_custom_cmd},
+	{MSGTYP_YTDL_INFO, {"url", "dlHash"}, handle_ytdlinfo},
+	{MSGTYP_YTDL_GET, {"url", "dlHash", "subtype", "?filename"}, handle_ytdlget},
+	{MSGTYP_YTDL_KILL, {"dlHash"}, handle_ytdlkill},
+};
+
+static_assert(msg_routes_distinct(msgRoutes), "message type ids collide, change MSGTYPE_SLOTS");
+
+void register_handlers()
+{
+	for(const msg_route &route : msgRoutes)
+	{
+		dispatcher::add(route);
+	}
+}
+
+//using the reference of the Json object because passing by value would copy the whole tree
+void processMessage(const Json &msg)
+{
+	try
+	{
+		if(!dispatcher::dispatch(msg))
 		{
-			messaging::sendMessage(MSGTYP_UNSUPP, "Unsupported message type");
+			Json requestId = msg.Contains("requestId")? msg["requestId"] : Json();
+			messaging::sendMessage(MSGTYP_UNSUPP, "Unsupported message type", requestId);
 		}
 	}
 	catch(grb_exception &e)
@@ -153,26 +227,26 @@ void processMessage(const Json &msg)
 	}
 }
 
-void handle_getversion(const Json &msg)
+void handle_getversion(const Json &msg, const msg_fields &fields)
 {
 	Json version = Json::Parse("{}");
 	version.AddProperty("type", Json("version"));
 	version.AddProperty("version", Json(versionStr));
-	messaging::sendMessage(version);
+	messaging::sendReply(version, fields.requestId);
 }
 
 //handles "get_available_dms" request
-void handle_getavail(const Json &msg)
+void handle_getavail(const Json &msg, const msg_fields &fields)
 {
 	Json avail = Json::Parse("{}");
 	avail.AddProperty("type", Json("available_dms"));
 	Json dms = Json::Parse("[]");
-	avail.AddProperty("availableDMs", dms);
-	messaging::sendMessage(avail);
+	avail.AddProperty("availableDMs", std::move(dms));
+	messaging::sendReply(avail, fields.requestId);
 }
 
 //handles "download" request
-void handle_download(const Json &msg)
+void handle_download(const Json &msg, const msg_fields &fields)
 {
 	try
 	{
@@ -184,24 +258,22 @@ void handle_download(const Json &msg)
 	}
 	catch(grb_exception &e)
 	{
-		messaging::sendMessage(MSGTYP_ERR, e.what());
+		messaging::sendMessage(MSGTYP_ERR, e.what(), fields.requestId);
 		PLOG_ERROR << e.what();
 	}
 }
 
 //handled user-specified download manager cmd
-//TODO: Json library cannot handle double quotes in strings
-// for example {"name": "\"jack\""} becomes \"jack\" instead of just "jack"
-void handle_custom_cmd(const Json &msg)
+void handle_custom_cmd(const Json &msg, const msg_fields &fields)
 {
 	try
 	{
-		string exeName = msg["procName"].AsString();
-		string filename = msg["filename"].AsString();
-		bool showConsole = msg["showConsole"].AsBool();
-		bool showSaveas = msg["showSaveas"].AsBool();
+		string exeName = fields[0]->AsString();
+		string filename = fields[1]->AsString();
+		bool showConsole = fields[2]->AsBool();
+		bool showSaveas = fields[3]->AsBool();
 
-		Json argsJSON = msg["args"];
+		const Json &argsJSON = *fields[4];
 		vector<string> args;
 
 		for(int i=0; i<argsJSON.Size(); i++)
@@ -211,37 +283,57 @@ void handle_custom_cmd(const Json &msg)
 			args.push_back(arg);
 		}
 
-		std::thread th1(custom_cmd_th, exeName, args, filename, showConsole, showSaveas);
+		std::thread th1(custom_cmd_th, exeName, args, filename, showConsole, showSaveas, fields.requestId);
 		th1.detach();
 	}
 	catch(grb_exception &e)
 	{
-		messaging::sendMessage(MSGTYP_ERR, e.what());
+		messaging::sendMessage(MSGTYP_ERR, e.what(), fields.requestId);
 		PLOG_ERROR << e.what();
 	}
 }
 
-void handle_ytdlinfo(const Json &msg)
+void handle_ytdlinfo(const Json &msg, const msg_fields &fields)
 {
-	string url = msg["url"].AsString();
-	string dlHash = msg["dlHash"].AsString();
+	string url = fields[0]->AsString();
+	string dlHash = fields[1]->AsString();
 
-	ytdl_args *arger = new ytdl_info(msg);
+	Json requestId = fields.requestId;
 
-	std::thread th1(ytdl_info_th, url, dlHash, arger);
-	th1.detach();
+	ytdl_info arger(msg);
+	vector<string> args = arger.getArgs();
+
+	try
+	{
+		//the output of a playlist can be hundreds of MB, it is taken line by line instead of being kept
+		//only its tail is retained, for when ytdl prints an error instead of the info
+		shared_ptr<ytdl_info_output> output = make_shared<ytdl_info_output>();
+		line_callback onLine = [dlHash, output](string_view line){ ytdl_info_line(dlHash, *output, line); };
+
+		//parsing and compressing the info is slow so it is done on the task pool
+		ytdl(MSGTYP_YTDL_INFO, url, dlHash, args, onLine, RETAIN_TAIL, [dlHash, requestId, output](process_result &res){
+			shared_ptr<const process_result> result = make_shared<const process_result>(std::move(res));
+			task_pool::run(dlHash, [dlHash, requestId, output, result](){ ytdl_info_done(dlHash, requestId, *output, *result); });
+		});
+	}
+	catch(exception &e)
+	{
+		string msg = "Error getting video info: ";
+		msg.append(e.what());
+		messaging::sendMessage(MSGTYP_ERR, msg, requestId);
+	}
 }
 
-void handle_ytdlget(const Json &msg)
+void handle_ytdlget(const Json &msg, const msg_fields &fields)
 {
-	string url = msg["url"].AsString();
-	string dlHash = msg["dlHash"].AsString();
-	string type = msg["subtype"].AsString();
+	string url = fields[0]->AsString();
+	string dlHash = fields[1]->AsString();
+	string type = fields[2]->AsString();
 
 	string filename = "";
-	if(msg.Contains("filename"))
+	if(fields[3] != NULL)
 	{
-		filename = msg["filename"].AsString();
+		filename = fields[3]->AsString();
 	}
 
 	ytdl_args *arger;
@@ -263,14 +355,16 @@ void handle_ytdlget(const Json &msg)
 		arger = new ytdl_playlist_audio(msg);
 	}
 
-	std::thread th1(ytdl_get_th, url, dlHash, arger, filename);
+	//the save dialog blocks so it gets its own thread, the download itself runs on the event loop
+	std::thread th1(ytdl_get_th, url, dlHash, arger, filename, fields.requestId);
 	th1.detach();
 }
 
-void handle_ytdlkill(const Json &msg)
+void handle_ytdlkill(const Json &msg, const msg_fields &fields)
 {
-	string dlHash = msg["dlHash"].AsString();
+	string dlHash = fields[0]->AsString();
 	killswitches::activate(dlHash);
+	utils::checkKillSwitches();
 }
 
 //launches FlashGot to perform a download with a DM
@@ -295,7 +389,7 @@ void flashgot_job(const string &jobJSON)
 	}
 }
 
-void custom_cmd_th(string exeName, vector<string> args, const string filename, bool showConsole, bool showSaveas)
+void custom_cmd_th(string exeName, vector<string> args, const string filename, bool showConsole, bool showSaveas, const Json requestId)
 {
 	try
 	{
@@ -352,110 +446,122 @@ void custom_cmd_th(string exeName, vector<string> args, const string filename, b
 	}
 	catch(grb_exception_gui &e)
 	{
-		messaging::sendMessage(MSGTYP_ERR_GUI, e.what());
+		messaging::sendMessage(MSGTYP_ERR_GUI, e.what(), requestId);
 	}
 	catch(exception &e)
 	{
 		string msg = "Error executing custom command: ";
 		msg.append(e.what());
-		messaging::sendMessage(MSGTYP_ERR, msg);
+		messaging::sendMessage(MSGTYP_ERR, msg, requestId);
 	}
 	catch(...){}	//ain't nothing we can do if we're here
 }
 
-void ytdl_info_th(const string url, const string dlHash, ytdl_args *arger)
+//called on the event loop for every line ytdl prints for ytdl_info
+void ytdl_info_line(const string &dlHash, ytdl_info_output &output, string_view line)
 {
-	try
+	if(line.length() > 0 && line.back() == '\n')
 	{
-		vector<string> args = arger->getArgs();
-		process_result res = ytdl(url, dlHash, args);
+		line.remove_suffix(1);
+	}
+	if(line.length() == 0)
+	{
+		return;
+	}
+
+	//playlists are outputted as one line of JSON for each list item and they get very big,
+	//so from the second line on the lines are checked and gzipped on the task pool while ytdl goes on
+	if(output.playlist)
+	{
+		output.playlist->add(line);
+	}
+	else if(output.first.length() == 0)
+	{
+		output.first.assign(line);
+	}
+	else
+	{
+		output.playlist = make_shared<playlist_stream>(dlHash);
+		output.playlist->add(output.first);
+		string().swap(output.first);
+		output.playlist->add(line);
+	}
+}
 
-		vector<string> lines = utils::strSplit(res.output, '\n');
+void ytdl_info_done(const string dlHash, const Json requestId, ytdl_info_output &output, const process_result &res)
+{
+	try
+	{
+		ytdl_check(res);
 
 		Json info;
 		string type = MSGTYP_YTDL_INFO;
+		bool playlistDone = false;
 
 		try
 		{
 			//if it's a playlist
-			if(lines.size() > 1)
+			if(output.playlist)
 			{
 				type = MSGTYP_YTDL_INFO_YTPL;
-				Json infoTmp = Json::Parse("[]");
 
-				//we have a for loop because playlists are outputted as one line of JSON for each list item
-				for(int i=0; i<lines.size(); i++)
-				{
-					Json j = utils::parseJSON(lines[i].c_str());
-					infoTmp.Push(j);
-				}
-
-				//we do this because sometimes JSON gets very big, specially for playlists
-				string infoStr = infoTmp.ToString();
-
-				//gzip the string and then base64 it and then send
-				const char * pointer = infoStr.data();
-				size_t size = infoStr.size();
-				string comp = gzip::compress(pointer, size, 9);
-				string infoB64 = to_base64(comp);
-				info = Json(infoB64);
+				//throws if one of the entries isn't JSON
+				output.playlist->finish();
+				playlistDone = true;
 			}
 			else
 			{
-				info = utils::parseJSON(lines[0]);
-
-				//remove big unused things from info to avoid JSON getting to big for native messaging
-				if(info.Contains("automatic_captions")){
-					info.Remove("automatic_captions");
-				}
-				if(info.Contains("subtitles")){
-					info.Remove("subtitles");
-				}
-				if(info.Contains("categories")){
-					info.Remove("categories");
-				}
-				if(info.Contains("requested_formats"))
-				{
-					info.Remove("requested_formats");
-				}
-				if(info.Contains("tags"))
-				{
-					info.Remove("tags");
-				}
-				if(info.Contains("description"))
-				{
-					info.Remove("description");
-				}
+				//everything parsed from the output is allocated from this document's arena
+				//and dropped in one go, instead of freeing it value by value
+				Json doc = Json::Parse("[]", true);
 
+				//the parsed values point into the line instead of copying its strings
+				//big unused things are skipped while parsing to avoid JSON getting to big for native messaging
+				info = utils::parseJSONInSitu(output.first, doc, &infoFilter);
 			}
 		}
 		catch(...)
 		{
 			//YTDL output not JSON
-			//Happens when YTDL outputs an error
+			//Happens when YTDL outputs an error, the tail of the output has it
 			info = Json(res.output);
 			PLOG_ERROR << "youtube-dl returned an error" << res.output;
 		}
 
+		//the compressed playlist is base64ed straight into the message
+		//failing to send it has nothing to do with the output of ytdl
+		if(playlistDone)
+		{
+			try
+			{
+				output.playlist->send(requestId);
+			}
+			catch(exception &e)
+			{
+				string msg = "Error sending playlist info: ";
+				msg.append(e.what());
+				messaging::sendMessage(MSGTYP_ERR, msg, requestId);
+			}
+			return;
+		}
+
 		Json msg = Json::Parse("{}");
 		msg.AddProperty("type", Json(type));
 		msg.AddProperty("dlHash", Json(dlHash));
-		msg.AddProperty("info", info);
+		msg.AddProperty("info", std::move(info));
 
-		messaging::sendMessage(msg);
+		messaging::sendReply(msg, requestId);
 	}
 	catch(exception &e)
 	{
 		string msg = "Error getting video info: ";
 		msg.append(e.what());
-		messaging::sendMessage(MSGTYP_ERR, msg);
+		messaging::sendMessage(MSGTYP_ERR, msg, requestId);
 	}
 	catch(...){}	//ain't nothing we can do if we're here
-
-	delete arger;
 }
 
-void ytdl_get_th(const string url, const string dlHash, ytdl_args *arger, const string filename)
+void ytdl_get_th(const string url, const string dlHash, ytdl_args *arger, const string filename, const Json requestId)
 {
 	try
 	{
@@ -488,9 +594,51 @@ void ytdl_get_th(const string url, const string dlHash, ytdl_args *arger, const
 		arger->addArg("--output");
 		arger->addArg(savePath);
 
-		output_callback callback(dlHash);
 		vector<string> args = arger->getArgs();
-		process_result res = ytdl(url, dlHash, args, &callback);
+		delete arger;
+		arger = NULL;
+
+		//hand the download over to the event loop
+		eventloop::post([url, dlHash, args, requestId]() mutable {
+			try
+			{
+				output_callback callback(dlHash);
+				line_callback onLine = [callback](string_view line) mutable { callback.call(line); };
+				//a download can run for hours, its progress is handled line by line and only the tail is kept
+				ytdl(MSGTYP_YTDL_GET, url, dlHash, args, onLine, RETAIN_TAIL, [dlHash, requestId](const process_result &res){
+					ytdl_get_done(dlHash, requestId, res);
+				});
+			}
+			catch(exception &e)
+			{
+				string msg = "Error downloading video: ";
+				msg.append(e.what());
+				messaging::sendMessage(MSGTYP_ERR, msg, requestId);
+			}
+		});
+	}
+	catch(exception &e)
+	{
+		string msg = "Error downloading video: ";
+		msg.append(e.what());
+		messaging::sendMessage(MSGTYP_ERR, msg, requestId);
+	}
+	catch(...){}	//ain't nothing we can do if we're here
+
+	delete arger;
+}
+
+void ytdl_get_done(const string dlHash, const Json requestId, const process_result &res)
+{
+	try
+	{
+		progress::finish(dlHash);
+
+		//a download can be cancelled before ytdl has printed anything
+		if(res.exitCode != YTDL_CANCEL_CODE)
+		{
+			ytdl_check(res);
+		}
 
 		string type;
 		if(res.exitCode == YTDL_CANCEL_CODE) type = MSGTYP_YTDL_KILL;
@@ -500,41 +648,57 @@ void ytdl_get_th(const string url, const string dlHash, ytdl_args *arger, const
 		Json msg = Json::Parse("{}");
 		msg.AddProperty("type", Json(type));
 		msg.AddProperty("dlHash", Json(dlHash));
-		messaging::sendMessage(msg);
+		msg.AddProperty("usage", metrics::usageJson(res.usage));
+		messaging::sendReply(msg, requestId);
 	}
 	catch(exception &e)
 	{
 		string msg = "Error downloading video: ";
 		msg.append(e.what());
-		messaging::sendMessage(MSGTYP_ERR, msg);
+		messaging::sendMessage(MSGTYP_ERR, msg, requestId);
 	}
 	catch(...){}	//ain't nothing we can do if we're here
-
-	delete arger;
 }
 
-process_result ytdl(const string &url, const string &dlHash, vector<string> &args, output_callback *callback)
+//launches ytdl on the event loop, onDone is called on the event loop when it exits
+//job is the type of the message that asked for it, what the job cost is recorded under it in the metrics
+void ytdl(const char *job, const string &url, const string &dlHash, vector<string> &args,
+		line_callback callback, output_retention retention, exit_callback onDone)
 {
 	try
 	{
 		//create a kill switch for this download and store it in the map
 		killswitches::add(dlHash);
 
-		process_result res = utils::launchExe("./yt-dlp", args, "", dlHash, callback);
-
-		killswitches::remove(dlHash);
-
-		if(res.output.length() == 0)
+		const char *ytdlExe = YTDL_EXE;
+#ifdef GRABBY_TESTING
+		//test builds run the yt-dlp GRABBY_YTDL points to, the replay driver points it to its stub
+		const char *testYtdl = getenv("GRABBY_YTDL");
+		if(testYtdl != NULL && testYtdl[0] != '\0')
 		{
-			throw grb_exception("could not read output from ytdl");
+			ytdlExe = testYtdl;
 		}
+#endif
 
-		return res;
+		utils::launchExeAsync(ytdlExe, args, "", dlHash, callback, [job, url, dlHash, args, onDone](process_result &res){
+			killswitches::remove(dlHash);
+			metrics::record(job, dlHash, url, args, res);
+			onDone(res);
+		}, retention);
 	}
 	catch(exception &e)
 	{
+		killswitches::remove(dlHash);
 		string msg = "Error in YoutubeDL execution: ";
 		msg.append(e.what());
 		throw grb_exception(msg.c_str());
 	}
 }
+
+void ytdl_check(const process_result &res)
+{
+	if(res.output.length() == 0)
+	{
+		throw grb_exception("Error in YoutubeDL execution: could not read output from ytdl");
+	}
+}
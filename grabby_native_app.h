@@ -4,22 +4,43 @@
 #include "ytdl_args.h"
 #include "types.h"
 #include "jsonla.h"
+#include "dispatcher.h"
 #include <plog/Log.h>
 #include <plog/Initializers/RollingFileInitializer.h>
 #include <string>
+#include <string_view>
+#include <memory>
+#include <stdint.h>
 
 using namespace ggicci;
 
+class playlist_stream;
+
+//what ytdl prints for ytdl_info, taken line by line as it comes
+//a video is a single line of JSON, a playlist is one line for each entry and they go into the playlist as they come
+struct ytdl_info_output
+{
+	std::string first;
+	std::shared_ptr<playlist_stream> playlist;
+};
+
+void on_stdin(uint32_t events);
+void process_raw_message(std::string_view raw_message);
+void register_handlers();
 void processMessage(const Json &msg);
-void handle_getversion(const Json &msg);
-void handle_getavail(const Json &msg);
-void handle_download(const Json &msg);
-void handle_custom_cmd(const Json &msg);
-void handle_ytdlinfo(const Json &msg);
-void handle_ytdlget(const Json &msg);
-void handle_ytdlkill(const Json &msg);
+void handle_getversion(const Json &msg, const msg_fields &fields);
+void handle_getavail(const Json &msg, const msg_fields &fields);
+void handle_download(const Json &msg, const msg_fields &fields);
+void handle_custom_cmd(const Json &msg, const msg_fields &fields);
+void handle_ytdlinfo(const Json &msg, const msg_fields &fields);
+void handle_ytdlget(const Json &msg, const msg_fields &fields);
+void handle_ytdlkill(const Json &msg, const msg_fields &fields);
 void flashgot_job(const std::string &jobJSON);
-void custom_cmd_th(std::string exeName, std::vector<std::string> args, const std::string filename, bool showConsole, bool showSaveas);
-void ytdl_info_th(const std::string url, const std::string dlHash, ytdl_args *arger);
-void ytdl_get_th(const std::string url, const std::string dlHash, ytdl_args *arger, const std::string filename);
-process_result ytdl(const std::string &url, const std::string &dlHash, std::vector<std::string> &args, output_callback *callback = NULL);
+void custom_cmd_th(std::string exeName, std::vector<std::string> args, const std::string filename, bool showConsole, bool showSaveas, const Json requestId);
+void ytdl_info_line(const std::string &dlHash, ytdl_info_output &output, std::string_view line);
+void ytdl_info_done(const std::string dlHash, const Json requestId, ytdl_info_output &output, const process_result &res);
+void ytdl_get_th(const std::string url, const std::string dlHash, ytdl_args *arger, const std::string filename, const Json requestId);
+void ytdl_get_done(const std::string dlHash, const Json requestId, const process_result &res);
+void ytdl(const char *job, const std::string &url, const std::string &dlHash, std::vector<std::string> &args,
+		line_callback callback, output_retention retention, exit_callback onDone);
+void ytdl_check(const process_result &res);
@@ -1,31 +1,116 @@
 #include "jsonla.h"
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
 #include <stdlib.h>
 #include <sstream>
 #include <algorithm>
+#include <charconv>
 
 namespace ggicci
 {
 using namespace std;
 
+/**
+ * \brief Append the UTF-8 encoding of the code point \em code to \em out.
+ */
+static void AppendUtf8(string& out, unsigned int code)
+{
+	if (code < 0x80) { out += (char)code; }
+	else if (code < 0x800)
+	{
+		out += (char)(0xC0 | (code >> 6));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000)
+	{
+		out += (char)(0xE0 | (code >> 12));
+		out += (char)(0x80 | ((code >> 6) & 0x3F));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+	else
+	{
+		out += (char)(0xF0 | (code >> 18));
+		out += (char)(0x80 | ((code >> 12) & 0x3F));
+		out += (char)(0x80 | ((code >> 6) & 0x3F));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+}
+
+/**
+ * \brief Convert the digits of a json number, which must already be known to be well formed.
+ * \details An \em integral number that fits in 64 bits is stored in \em integer and true
+ * 			is returned. Anything else is stored in \em number. \em scratch is only used for
+ * 			numbers out of the range of a double, which strtod turns into infinity or zero.
+ */
+static bool ConvertNumber(const char* first, const char* last, bool integral, int64_t& integer, double& number, string& scratch)
+{
+	if (integral && from_chars(first, last, integer).ec == errc()) { return true; }
+	if (from_chars(first, last, number).ec != errc())
+	{
+		scratch.assign(first, last);
+		number = strtod(scratch.c_str(), 0);
+	}
+	return false;
+}
+
 /* Json */
-Json Json::Parse(const char* json_string)
+Json Json::Parse(string_view json_string)
+{
+	return ParseIn(json_string, 0);
+}
+
+Json Json::Parse(string_view json_string, bool document)
+{
+	return ParseIn(json_string, document ? new JsonArena() : 0);
+}
+
+Json Json::Parse(string_view json_string, const Json& document)
+{
+	return ParseIn(json_string, document.arena_);
+}
+
+Json Json::Parse(string_view json_string, const JsonFilter& filter, bool document)
+{
+	return ParseIn(json_string, document ? new JsonArena() : 0, &filter);
+}
+
+Json Json::Parse(string_view json_string, const JsonFilter& filter, const Json& document)
+{
+	return ParseIn(json_string, document.arena_, &filter);
+}
+
+Json Json::ParseInSitu(string_view json_string, const Json& document, const JsonFilter* filter)
+{
+	return ParseIn(json_string, document.arena_, filter, true);
+}
+
+Json Json::ParseIn(string_view json_string, JsonArena* arena, const JsonFilter* filter, bool insitu)
 {
-	Parser parser(json_string);
+	// the root itself is not allocated from the arena, it owns a reference on it
+	// so that the arena goes away together with the last root of the document
+	Json retval;
+	if (arena)
+	{
+		arena->AddRef();
+		retval.arena_ = arena;
+		retval.ownsArena_ = true;
+	}
+	Parser parser(json_string, arena, filter, insitu);
 	Json *json = parser.ConsumeValue(false);
-	Json retval(json);
-	delete json;
+	retval.TakeValue(*json);
+	DeleteNode(json);
 	return retval;
 }
 
-Json::Json() : kind_(kNull), data_(0), lastInsertId_(0) { }
-Json::Json(int num) : kind_(kNumber), data_(new double(num)), lastInsertId_(0) { }
-Json::Json(double num) : kind_(kNumber), data_(new double(num)), lastInsertId_(0) { }
-Json::Json(const string& str) : kind_(kString), data_(new string(str)), lastInsertId_(0) { }
-Json::Json(const char* str) : kind_(kString), data_(new string(str)), lastInsertId_(0) { }
-Json::Json(bool boo) : kind_(kBool), data_(new bool(boo)), lastInsertId_(0) { }
-Json::Json(const Json& rhs) : kind_(kNull), data_(0), lastInsertId_(0)
+Json::Json() : value_(), arena_(0), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false) { }
+Json::Json(int num) : value_(), arena_(0), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false) { *this = num; }
+Json::Json(int64_t num) : value_(), arena_(0), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false) { *this = num; }
+Json::Json(double num) : value_(), arena_(0), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false) { *this = num; }
+Json::Json(const string& str) : value_(), arena_(0), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false) { SetString(str); }
+Json::Json(const char* str) : value_(), arena_(0), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false) { SetString(str); }
+Json::Json(bool boo) : value_(), arena_(0), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false) { *this = boo; }
+Json::Json(const Json& rhs) : value_(), arena_(0), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false)
 {
 	TRACK("Json::Json(const Json& rhs)");
 	DoDeepCopy(rhs);
@@ -40,107 +125,181 @@ Json& Json::operator = (const Json& rhs)
 	return *this;
 }
 
-Json::Json(Json* rhs) : kind_(rhs->kind_), data_(rhs->data_), lastInsertId_(rhs->lastInsertId_), order_(rhs->order_)
+Json::Json(Json&& rhs) noexcept : value_(), arena_(0), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false)
+{
+	TRACK("Json::Json(Json&& rhs)");
+	DoMove(rhs);
+}
+
+Json& Json::operator = (Json&& rhs)
 {
-	TRACK("Json::Json(Json* rhs)");
-	rhs->data_ = 0;
+	TRACK("Json& Json::operator = (Json&& rhs)");
+	if (this == &rhs) { return *this; }
+	if (arena_ && !ownsArena_)
+	{
+		// a value inside a document can only point into its own arena
+		if (rhs.arena_ != arena_)
+		{
+			Release();
+			DoDeepCopy(rhs);
+			return *this;
+		}
+		TakeValue(rhs);
+		return *this;
+	}
+	// rhs may be a value inside this very document, take it before letting go of the arena
+	Json tmp(std::move(rhs));
+	Release();
+	DoMove(tmp);
+	return *this;
 }
 
-Json::Json(ObjectData* obj) : kind_(kObject), data_(obj), lastInsertId_(0) { }
-Json::Json(ArrayData* arr) : kind_(kArray), data_(arr), lastInsertId_(0) { }
+Json::Json(JsonArena* arena)
+	: value_(), arena_(arena), kind_(kNull), store_(kInlineString), inlineSize_(0), ownsArena_(false) { }
+
+Json* Json::NewNode(JsonArena* arena)
+{
+	if (!arena) { return new Json(); }
+	return new (arena->allocate(sizeof(Json), alignof(Json))) Json(arena);
+}
+
+void Json::DeleteNode(Json* json)
+{
+	// values allocated from an arena never own it and are never destroyed one by one
+	if (json && (!json->arena_ || json->ownsArena_)) { delete json; }
+}
 
 void Json::DoDeepCopy(const Json& rhs)
 {
 	TRACK("void Json::DoDeepCopy(const Json& rhs)");
 	kind_ = rhs.kind_;
-	lastInsertId_ = rhs.lastInsertId_;
-	order_ = rhs.order_;
 	switch (kind_)
 	{
-		case kNull: data_ = 0; break;
-		case kNumber: data_ = new double(*static_cast<const double*>(rhs.data_)); break;
-		case kString: data_ = new string(*static_cast<const string*>(rhs.data_)); break;
-		case kBool: data_ = new bool(*static_cast<const bool*>(rhs.data_)); break;
+		case kNull: break;
+		case kNumber:
+		{
+			value_ = rhs.value_;
+			store_ = rhs.store_;
+			break;
+		}
+		case kString: SetString(rhs.StringValue()); break;
+		case kBool: value_.boolean = rhs.value_.boolean; break;
 		case kArray:
 		{
-			ArrayData *tmp = new ArrayData();
-			const ArrayData& data = *CAST_JSON_ARR(rhs.data_);
+			ArrayData *tmp = NewData<ArrayData>(Resource());
+			const ArrayData& data = *CAST_JSON_ARR(rhs.value_.data);
+			tmp->reserve(data.size());
 			ArrayData::const_iterator cit = data.begin();
 			for (; cit != data.end(); ++cit)
 			{
-				tmp->push_back(new Json(*(*cit)));
+				Json *item = NewNode(arena_);
+				item->DoDeepCopy(*(*cit));
+				tmp->push_back(item);
 			}
-			data_ = tmp;
+			value_.data = tmp;
 			break;
 		}
 		case kObject:
 		{
-			ObjectData *tmp = new ObjectData();
-			const ObjectData& data = *CAST_JSON_OBJ(rhs.data_);
-			ObjectData::const_iterator cit = data.begin();
-			for (; cit != data.end(); ++cit)
+			ObjectData *tmp = NewData<ObjectData>(Resource());
+			const ObjectData& data = *CAST_JSON_OBJ(rhs.value_.data);
+			tmp->entries.reserve(data.entries.size());
+			for (size_t i = 0; i < data.entries.size(); ++i)
 			{
-				tmp->insert(make_pair(cit->first, new Json(*cit->second)));
+				Json *item = NewNode(arena_);
+				item->DoDeepCopy(*data.entries[i].second);
+				tmp->Append(data.entries[i].first, item);
 			}
-			data_ = tmp;
+			value_.data = tmp;
 			break;
 		}
 		default: break;
 	}
 }
 
+void Json::DoMove(Json& rhs)
+{
+	TRACK("void Json::DoMove(Json& rhs)");
+	TakeValue(rhs);
+	arena_ = rhs.arena_;
+	ownsArena_ = rhs.ownsArena_;
+	if (arena_ && !ownsArena_)
+	{
+		// taken out of a document, keep the arena alive
+		arena_->AddRef();
+		ownsArena_ = true;
+	}
+	if (rhs.ownsArena_)
+	{
+		rhs.arena_ = 0;
+		rhs.ownsArena_ = false;
+	}
+}
+
 void Json::Release()
 {
 	TRACK("void Json::Release()");
 	TRACK("----------------------------------- Delete[" << kind_ << "]: " << ToString());
+	if (arena_)
+	{
+		// the data stays in the arena until the whole document is dropped
+		kind_ = kNull;
+		if (ownsArena_)
+		{
+			ownsArena_ = false;
+			arena_->Release();
+			arena_ = 0;
+		}
+		return;
+	}
 	switch (kind_)
 	{
-		case kNumber: delete static_cast<double*>(data_); break;
-		case kString: delete static_cast<string*>(data_); break;
-		case kBool: delete static_cast<bool*>(data_); break;
+		case kString:
+		{
+			if (store_ == kOwnedString) { delete[] value_.str.ptr; }
+			break;
+		}
 		case kObject:
 		{
-			Json::DestroyObjectData(*CAST_JSON_OBJ(data_));
-			delete CAST_JSON_OBJ(data_);
+			Json::DestroyObjectData(*CAST_JSON_OBJ(value_.data));
+			delete CAST_JSON_OBJ(value_.data);
 			break;
 		}
 		case kArray:
 		{
-			Json::DestroyArrayData(*CAST_JSON_ARR(data_));
-			delete CAST_JSON_ARR(data_);
+			Json::DestroyArrayData(*CAST_JSON_ARR(value_.data));
+			delete CAST_JSON_ARR(value_.data);
 			break;
 		}
 		default: break;
 	}
-	data_ = 0;
 	kind_ = kNull;
 }
 
 Json::~Json()
 {
 	TRACK("~Json");
-	if (!data_) { return; }
+	if (kind_ == kNull && !ownsArena_) { return; }
 	Release();
 }
 
 bool Json::IsEmpty() const
 {
-	if (IsObject()) { return CAST_JSON_OBJ(data_)->size() == 0; }
-	if (IsArray()) { return CAST_JSON_ARR(data_)->size() == 0; }
+	if (IsObject()) { return CAST_JSON_OBJ(value_.data)->entries.empty(); }
+	if (IsArray()) { return CAST_JSON_ARR(value_.data)->size() == 0; }
 	return false;
 }
 
 bool Json::Contains(const char* key) const
 {
 	if (!IsObject()) { return false; }
-	const ObjectData &data = *CAST_JSON_OBJ(data_);
-	return data.find(key) != data.end();
+	return CAST_JSON_OBJ(value_.data)->Find(key) >= 0;
 }
 
 int Json::Size() const
 {
 	if (!IsArray()) { return 1; } 
-	return CAST_JSON_ARR(data_)->size();
+	return CAST_JSON_ARR(value_.data)->size();
 }
 
 vector<string> Json::Keys() const
@@ -148,11 +307,11 @@ vector<string> Json::Keys() const
 	vector<string> keys;
 	if (IsObject())
 	{
-		ObjectData *data = CAST_JSON_OBJ(data_);
-		ObjectData::const_iterator cit = data->begin();
-		for (; cit != data->end(); ++cit)
+		const ObjectData& data = *CAST_JSON_OBJ(value_.data);
+		keys.reserve(data.entries.size());
+		for (size_t i = 0; i < data.entries.size(); ++i)
 		{
-			keys.push_back(cit->first);
+			keys.push_back(string(data.entries[i].first.data(), data.entries[i].first.size()));
 		}
 	}
 	return keys;
@@ -161,46 +320,67 @@ vector<string> Json::Keys() const
 Json& Json::Push(const Json& rhs)
 {
 	TRACK("Json& Json::Push(const Json& rhs)");
+	PushNull() = rhs;
+	return *this;
+}
+
+Json& Json::Push(Json&& rhs)
+{
+	TRACK("Json& Json::Push(Json&& rhs)");
+	PushNull() = std::move(rhs);
+	return *this;
+}
+
+Json& Json::PushNull()
+{
+	Json* item = NewNode(arena_);
 	switch (kind_)
 	{
 		case kArray:
 		{
-			ArrayData *data = CAST_JSON_ARR(data_);
-			data->push_back(new Json(rhs));
+			ArrayData *data = CAST_JSON_ARR(value_.data);
+			data->push_back(item);
 			break;
 		}
 		case kNumber: case kString: case kBool: case kNull: case kObject:
 		{
-			Json* old = new Json(this);
+			Json* old = NewNode(arena_);
+			old->TakeValue(*this);
 			kind_ = Json::kArray;
-			ArrayData *tmp = new ArrayData();
+			ArrayData *tmp = NewData<ArrayData>(Resource());
 			tmp->push_back(old);
-			tmp->push_back(new Json(rhs));
-			data_ = tmp;
+			tmp->push_back(item);
+			value_.data = tmp;
 			break;
 		}
 		default: break;
 	}
-	return *this;
+	return *item;
 }
 
 Json& Json::AddProperty(const string& key, const Json& value)
 {
 	TRACK("Json& Json::AddProperty(const string& key, const Json& value)");
 	(*this)[key.c_str()] = value;
-	order_[lastInsertId_++] = key;
+	return *this;
+}
+
+Json& Json::AddProperty(const string& key, Json&& value)
+{
+	TRACK("Json& Json::AddProperty(const string& key, Json&& value)");
+	(*this)[key.c_str()] = std::move(value);
 	return *this;
 }
 
 Json& Json::Remove(const string& key)
 {
 	TRACK("Json& Json::Remove(const string& key)");
-	ObjectData& data = Data<ObjectData>();
-	ObjectData::iterator it = data.find(key);
-	if (it != data.end())
+	ObjectData& data = Object();
+	int pos = data.Find(key);
+	if (pos >= 0)
 	{
-		delete it->second;
-		data.erase(it);
+		DeleteNode(data.entries[pos].second);
+		data.Erase(pos);
 	}
 	return *this;
 }
@@ -208,50 +388,67 @@ Json& Json::Remove(const string& key)
 void Json::Remove(int index)
 {
 	TRACK("void Json::Remove(int index)");
-	ArrayData& data = Data<ArrayData>();
+	ArrayData& data = Array();
 	if (index >= 0 && index < Size())
 	{
 		ArrayData::iterator it = data.begin() + index;
-		delete (*it);
+		DeleteNode(*it);
 		data.erase(it);
 	}
 }
 
 int Json::AsInt() const
 {
-	return (int)Data<double>();
+	return (int)AsInt64();
+}
+
+int64_t Json::AsInt64() const
+{
+	if (kind_ != kNumber) { throw BadConversionException(); }
+	if (store_ == kIntegerNumber) { return value_.integer; }
+	return (int64_t)value_.number;
 }
 
 double Json::AsDouble() const
 {
-	return Data<double>();
+	if (kind_ != kNumber) { throw BadConversionException(); }
+	if (store_ == kIntegerNumber) { return (double)value_.integer; }
+	return value_.number;
 }
 
 bool Json::AsBool() const
 {
-	return Data<bool>();
+	if (kind_ != kBool) { throw BadConversionException(); }
+	return value_.boolean;
 }
 
 string Json::AsString() const
 {
-	return Data<string>().c_str();
+	if (!IsString()) { throw BadConversionException(); }
+	string_view str = StringValue();
+	return string(str.data(), str.size());
 }
 
 const Json& Json::operator [] (int index) const
 {
-	return *Data<ArrayData>()[index];
+	return *Array()[index];
 }
 
 Json& Json::operator [] (int index)
 {
-	return *Data<ArrayData>()[index];
+	return *Array()[index];
 }
 
 const Json& Json::operator[] (const char* key) const
 {
-	ObjectData& data = const_cast<ObjectData&>(Data<ObjectData>());
-	if (data.find(key) == data.end()) { data[key] = new Json(); }
-	return *(data[key]);
+	ObjectData& data = Object();
+	int pos = data.Find(key);
+	if (pos < 0)
+	{
+		pos = data.entries.size();
+		data.Append(key, NewNode(arena_));
+	}
+	return *data.entries[pos].second;
 }
 
 Json& Json::operator[] (const char* key)
@@ -261,27 +458,38 @@ Json& Json::operator[] (const char* key)
 
 Json& Json::operator = (int num)
 {
-	return operator = ((double)num);
+	return operator = ((int64_t)num);
+}
+
+Json& Json::operator = (int64_t num)
+{
+	Release();
+	kind_ = kNumber;
+	store_ = kIntegerNumber;
+	value_.integer = num;
+	return *this;
 }
 
 Json& Json::operator = (double num)
 {
 	Release();
 	kind_ = kNumber;
-	data_ = new double(num);
+	store_ = kDoubleNumber;
+	value_.number = num;
 	return *this;
 }
 
 Json& Json::operator = (const string& str)
 {
-	return operator = (str.c_str());
+	Release();
+	SetString(str);
+	return *this;
 }
 
 Json& Json::operator = (const char* str)
 {
 	Release();
-	kind_ = kString;
-	data_ = new string(str);
+	SetString(str);
 	return *this;
 }
 
@@ -289,107 +497,142 @@ Json& Json::operator = (bool boo)
 {
 	Release();
 	kind_ = kBool;
-	data_ = new bool(boo);
+	value_.boolean = boo;
 	return *this;
 }
 
 string Json::ToString() const
 {
-	ostringstream oss;
+	string out;
+	out.reserve(256);
+	Write(out);
+	return out;
+}
+
+string Json::ToStringOrderedTrimmed() const
+{
+	string out;
+	out.reserve(256);
+	Write(out, true);
+	return out;
+}
+
+void Json::Write(string& out, bool compact) const
+{
 	switch (kind_)
 	{
-		case kNumber: oss << *static_cast<double*>(data_); break;
-		case kString: oss << "\"" << *static_cast<string*>(data_) << "\""; break;
-		case kBool: oss << boolalpha << *static_cast<bool*>(data_); break;
-		case kNull: oss << "null"; break;
-		case kObject:
+		case kNumber:
 		{
-			ObjectData& data = *CAST_JSON_OBJ(data_);
-			ObjectData::const_iterator cit = data.begin();
-			oss << "{ ";
-			bool unique = true;
-			for (; cit != data.end(); ++cit)
+			// the shortest text that reads back as the same double, independent of the locale
+			char buf[32];
+			to_chars_result res;
+			if (store_ == kIntegerNumber) { res = to_chars(buf, buf + sizeof(buf), value_.integer); }
+			else if (isfinite(value_.number)) { res = to_chars(buf, buf + sizeof(buf), value_.number); }
+			else
 			{
-				oss << (unique ? "\"" : ", \"") << cit->first << "\": " << cit->second->ToString();
-				unique = false;
+				// json has no infinity or NaN
+				out += "null";
+				break;
 			}
-			oss << " }";
+			out.append(buf, res.ptr - buf);
 			break;
 		}
-		case kArray:
+		case kString:
 		{
-			ArrayData& data = *CAST_JSON_ARR(data_);
-			ArrayData::const_iterator cit = data.begin();
-			oss << "[ ";
-			bool unique = true;
-			for (; cit != data.end(); ++cit)
-			{
-				oss << (unique ? "" : ", ") << (*cit)->ToString();
-				unique = false;
-			}
-			oss << " ]";
+			string_view str = StringValue();
+			WriteString(out, str.data(), str.size());
 			break;
 		}
-		default : break;
-	}
-	return oss.str();
-}
-
-string Json::ToStringOrderedTrimmed() const
-{
-	ostringstream oss;
-	switch (kind_)
-	{
-		case kNumber: oss << *static_cast<double*>(data_); break;
-		case kString: oss << "\"" << *static_cast<string*>(data_) << "\""; break;
-		case kBool: oss << boolalpha << *static_cast<bool*>(data_); break;
-		case kNull: oss << "null"; break;
+		case kBool: out += value_.boolean ? "true" : "false"; break;
+		case kNull: out += "null"; break;
 		case kObject:
 		{
-			ObjectData& data = *CAST_JSON_OBJ(data_);
-			oss << "{";
-			bool unique = true;
-
-			for(int i=0; i<lastInsertId_; i++)
+			const ObjectData& data = *CAST_JSON_OBJ(value_.data);
+			out += compact ? "{" : "{ ";
+			for (size_t i = 0; i < data.entries.size(); ++i)
 			{
-				string key = order_.at(i);
-				ObjectData::const_iterator cit = data.find(key);
-				oss << (unique ? "\"" : ",\"") << cit->first << "\":" << cit->second->ToString();
-				unique = false;
+				if (i) { out += compact ? "," : ", "; }
+				const ObjectEntry& entry = data.entries[i];
+				WriteString(out, entry.first.data(), entry.first.size());
+				out += compact ? ":" : ": ";
+				entry.second->Write(out, compact);
 			}
-
-			oss << "}";
+			out += compact ? "}" : " }";
 			break;
 		}
 		case kArray:
 		{
-			ArrayData& data = *CAST_JSON_ARR(data_);
-			ArrayData::const_iterator cit = data.begin();
-			oss << "[ ";
-			bool unique = true;
-			for (; cit != data.end(); ++cit)
+			const ArrayData& data = *CAST_JSON_ARR(value_.data);
+			out += compact ? "[" : "[ ";
+			for (ArrayData::const_iterator cit = data.begin(); cit != data.end(); ++cit)
 			{
-				oss << (unique ? "" : ", ") << (*cit)->ToString();
-				unique = false;
+				if (cit != data.begin()) { out += compact ? "," : ", "; }
+				(*cit)->Write(out, compact);
 			}
-			oss << " ]";
+			out += compact ? "]" : " ]";
 			break;
 		}
 		default : break;
 	}
-	return oss.str();
-
+}
 
+/* Private Members */
+void Json::SetString(string_view str)
+{
+	kind_ = kString;
+	if (str.size() <= kInlineCapacity)
+	{
+		store_ = kInlineString;
+		inlineSize_ = str.size();
+		memcpy(value_.chars, str.data(), str.size());
+		return;
+	}
+	char *chars = arena_ ? static_cast<char*>(arena_->allocate(str.size(), 1)) : new char[str.size()];
+	memcpy(chars, str.data(), str.size());
+	store_ = kOwnedString;
+	value_.str.ptr = chars;
+	value_.str.size = str.size();
+}
 
+void Json::WriteString(string& out, const char* str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	out += '\"';
+	size_t start = 0;
+	for (size_t i = 0; i < len; ++i)
+	{
+		unsigned char ch = str[i];
+		if (ch >= 0x20 && ch != '\"' && ch != '\\') { continue; }
+		// copy the run of characters that need no escaping in one go
+		out.append(str + start, i - start);
+		start = i + 1;
+		switch (ch)
+		{
+			case '\"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\b': out += "\\b"; break;
+			case '\f': out += "\\f"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+			{
+				char esc[] = { '\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xf] };
+				out.append(esc, sizeof(esc));
+				break;
+			}
+		}
+	}
+	out.append(str + start, len - start);
+	out += '\"';
 }
 
-/* Private Members */
 void Json::DestroyArrayData(ArrayData& arr)
 {
 	TRACK("void Json::DestroyArrayData(ArrayData& arr)");
 	for (ArrayData::iterator it = arr.begin(); it != arr.end(); ++it)
 	{
-		delete *it;
+		DeleteNode(*it);
 		*it = 0;
 	}
 }
@@ -397,17 +640,80 @@ void Json::DestroyArrayData(ArrayData& arr)
 void Json::DestroyObjectData(ObjectData& obj)
 {
 	TRACK("void Json::DestroyObjectData(ObjectData& obj)");
-	for (ObjectData::iterator it = obj.begin(); it != obj.end(); ++it)
+	for (size_t i = 0; i < obj.entries.size(); ++i)
 	{
-		delete it->second;
-		it->second = 0;
+		DeleteNode(obj.entries[i].second);
+		obj.entries[i].second = 0;
 	}
 }
 
+/* Json::ObjectData */
+int Json::ObjectData::Find(string_view key) const
+{
+	if (index.empty())
+	{
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			if (string_view(entries[i].first) == key) { return i; }
+		}
+		return -1;
+	}
+	size_t mask = index.size() - 1;
+	for (size_t slot = hash<string_view>()(key) & mask; ; slot = (slot + 1) & mask)
+	{
+		int pos = index[slot];
+		if (pos < 0) { return -1; }
+		if (string_view(entries[pos].first) == key) { return pos; }
+	}
+}
+
+void Json::ObjectData::Append(string_view key, Json* value)
+{
+	entries.emplace_back(StringData(key, entries.get_allocator()), value);
+	if (entries.size() <= kIndexThreshold) { return; }
+	// keep the table at most half full so that probes stay short
+	if (entries.size() * 2 > index.size()) { Reindex(); }
+	else { IndexEntry(entries.size() - 1); }
+}
+
+void Json::ObjectData::Erase(int pos)
+{
+	entries.erase(entries.begin() + pos);
+	// the positions after pos have all moved, removing members is rare enough to rebuild
+	if (!index.empty()) { Reindex(); }
+}
+
+void Json::ObjectData::Reindex()
+{
+	if (entries.size() <= kIndexThreshold)
+	{
+		index.clear();
+		return;
+	}
+	size_t size = 2 * kIndexThreshold;
+	while (size < entries.size() * 4) { size *= 2; }
+	index.assign(size, -1);
+	for (size_t i = 0; i < entries.size(); ++i) { IndexEntry(i); }
+}
+
+void Json::ObjectData::IndexEntry(int pos)
+{
+	size_t mask = index.size() - 1;
+	size_t slot = hash<string_view>()(entries[pos].first) & mask;
+	while (index[slot] >= 0) { slot = (slot + 1) & mask; }
+	index[slot] = pos;
+}
+
 /* Json::Parser */
-Json::Parser::Parser(const char* json_string)
+Json::Parser::Parser(string_view json_string, JsonArena* arena, const JsonFilter* filter, bool insitu)
 {
-	source = json_string;
+	source = json_string.data();
+	length = json_string.size();
+	this->insitu = insitu;
+	this->arena = arena;
+	this->filter = filter;
+	filterMask = filter ? filter->AllPaths() : 0;
+	depth = 0;
 	pos = -1;
 	character = ' ';
 	token = "";
@@ -434,7 +740,7 @@ Json* Json::Parser::ConsumeValue(bool section/* = true */)
 	{
 		SkipWhitespaces();
 		NextCharacter();
-		if (!EOL()) { UnexpectedToken(); }
+		if (!EOL()) { DeleteNode(json); UnexpectedToken(); }
 	}
 	if (section) { SkipWhitespaces(); }
 	return json;
@@ -443,50 +749,46 @@ Json* Json::Parser::ConsumeValue(bool section/* = true */)
 Json* Json::Parser::ConsumeNumber()
 {
 	TRACK("Json* Json::Parser::ConsumeNumber()");
-	token = "";
+	// the grammar is checked here, the digits are converted straight from source
+	int start = pos + 1;
 	NextCharacter();
 	// negative
-	if ('-' == character) { Concat(); NextCharacter(); }
+	if ('-' == character) { NextCharacter(); }
 	bool loop = true;
 	bool dot = false;
+	bool exponent = false;
 	if (!isdigit(character)) { UnexpectedToken(); }
-	Concat(); // the first digit or after '-'
 	if ('0' == character) {  loop = false; }
 	while (loop) // * loop
 	{
 		if (!isdigit(NextCharacter())) { Retract(); break; }
-		Concat();
 	}
 	if (isdigit(NextCharacter())) { UnexpectedToken(); } // fix 000.3
-	if ('.' == character) { Concat(); dot = true; }
+	if ('.' == character) { dot = true; }
 	if (dot) // met '.', at least need one digit
 	{
 		if (!isdigit(NextCharacter())) { UnexpectedToken(); }
-		Concat();
 	}
 	while (dot) // * loop
 	{
 		NextCharacter();
 		if (!isdigit(character)) { break; }
-		Concat();
 	}
 	// confront with scientific notation
 	if ('e' == character || 'E' == character)
 	{
-		Concat();
+		exponent = true;
 		NextCharacter();
-		if ('+' == character || '-' == character) { Concat(); }
+		if ('+' == character || '-' == character) { ; }
 		else if (isdigit(character)) { Retract(); }
 		else { UnexpectedToken(); }
 		// at least need one digit after '+' or '-' or 'E' or 'e'
 		if (!isdigit(NextCharacter())) { UnexpectedToken(); }
-		Concat();
 		while (true)
 		{
 			NextCharacter();
 			// if (EOL() || isspace(character)) { break; }
 			if (!isdigit(character)) { Retract(); break; }
-			Concat();
 		}
 	}
 	else
@@ -495,44 +797,94 @@ Json* Json::Parser::ConsumeNumber()
 	}
 	// else if (EOL() || isspace(character)) { ; } 
 	// else { UnexpectedToken(); } // fix -23.0s
-	return new Json(atof(token.c_str()));
+	const char *first = source + start;
+	const char *last = source + pos + 1;
+	Json *json = NewNode(arena);
+	int64_t integer;
+	double number;
+	if (ConvertNumber(first, last, !dot && !exponent, integer, number, token)) { *json = integer; }
+	else { *json = number; }
+	return json;
 } // end fn:ConsumeNumber
 
 Json* Json::Parser::ConsumeString()
 {
 	TRACK("Json* Json::Parser::ConsumeString()");
+	bool escaped;
+	string_view str = ConsumeStringView(escaped);
+	Json *json = NewNode(arena);
+	if (insitu && !escaped && str.size() > kInlineCapacity)
+	{
+		json->kind_ = kString;
+		json->store_ = kBorrowedString;
+		json->value_.str.ptr = str.data();
+		json->value_.str.size = str.size();
+	}
+	else
+	{
+		json->SetString(str);
+	}
+	return json;
+} // end fn:ConsumeString
+
+string_view Json::Parser::ConsumeStringView(bool& escaped)
+{
+	TRACK("string_view Json::Parser::ConsumeStringView(bool& escaped)");
 	SkipWhitespaces();
 	// consume the open quote
 	if ('\"' != NextCharacter()) { UnexpectedToken(); }
-	token = "";
+	// most strings have no escapes, find the close quote without copying anything
+	const char* begin = source + pos + 1;
+	const char* end = source + length;
+	const char* p = begin;
+	while (p < end && '\"' != *p && '\\' != *p && (unsigned char)*p >= 0x20) { ++p; }
+	if (p < end && '\"' == *p)
+	{
+		pos = p - source;
+		character = *p;
+		escaped = false;
+		return string_view(begin, p - begin);
+	}
+	if (p == end || '\\' != *p)
+	{
+		pos = p - source;
+		character = p < end ? *p : '\0';
+		UnexpectedToken();
+	}
+	// unescape the rest into token
+	escaped = true;
+	token.assign(begin, p - begin);
+	pos = p - source - 1;
 	while (true)
 	{
 		// meet the close quote, end loop
 		if ('\"' == NextCharacter()) { break; }
-		// the escape characters
+		// the escape characters are decoded, the value holds the real string
 		if ('\\' == character)
 		{
-			Concat();
 			NextCharacter();
 			switch (character)
 			{
-				case '\"': case '\\': case '/': case 'b':
-				case 'f': case 'n': case 'r': case 't':
-				{
-					Concat();
-					break;
-				}
+				case '\"': case '\\': case '/': { Concat(); break; }
+				case 'b': { token += '\b'; break; }
+				case 'f': { token += '\f'; break; }
+				case 'n': { token += '\n'; break; }
+				case 'r': { token += '\r'; break; }
+				case 't': { token += '\t'; break; }
 				case 'u':
 				{
-					Concat();
-					for (int i = 0; i < 4; ++i)
+					unsigned int code = ConsumeHex4();
+					if (code >= 0xD800 && code <= 0xDBFF && pos + 2 < length && '\\' == source[pos + 1] && 'u' == source[pos + 2])
 					{
-						if (!isxdigit(NextCharacter()))
-						{
-							UnexpectedToken();
-						}
-						Concat();
+						// a surrogate pair makes up one code point
+						NextCharacter();
+						NextCharacter();
+						unsigned int low = ConsumeHex4();
+						if (low >= 0xDC00 && low <= 0xDFFF) { code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00); }
+						else { ConcatUtf8(0xFFFD); code = low; }
 					}
+					if (code >= 0xD800 && code <= 0xDFFF) { code = 0xFFFD; }
+					ConcatUtf8(code);
 					break;
 				}
 				default:
@@ -544,44 +896,50 @@ Json* Json::Parser::ConsumeString()
 		}
 		else // if not a escape character
 		{
-			if (iscntrl(character)) { UnexpectedToken(); }
+			if (character < 0x20) { UnexpectedToken(); }
 			Concat();
 		}
 	}
-	return new Json(token);
-} // end fn:ConsumeString
+	return token;
+} // end fn:ConsumeStringView
 
 Json* Json::Parser::ConsumeBool()
 {
 	TRACK("Json* Json::Parser::ConsumeBool()");
 	char ch = NextCharacter();
 	Retract();
-	if ('t' == ch) { ConsumeSpecific("true"); return new Json(true); }
-	else { ConsumeSpecific("false"); return new Json(false); }
+	bool boo = ('t' == ch);
+	ConsumeSpecific(boo ? "true" : "false");
+	Json *json = NewNode(arena);
+	*json = boo;
+	return json;
 } // end fn:ConsumeBool
 
 Json* Json::Parser::ConsumeNull()
 {
 	TRACK("Json* Json::Parser::ConsumeNull()");
 	ConsumeSpecific("null");
-	return new Json();
+	return NewNode(arena);
 } // end fn:ConsumeNull
 
 Json* Json::Parser::ConsumeObject()
 {
 	TRACK("Json* Json::Parser::ConsumeObject()");
-	ObjectData *obj = new ObjectData();
-	if ('{' != NextCharacter()) { UnexpectedToken(); }
+	Json *json = NewNode(arena);
+	ObjectData *obj = json->NewData<ObjectData>(json->Resource());
+	json->kind_ = kObject;
+	json->value_.data = obj;
+	if ('{' != NextCharacter()) { DeleteNode(json); UnexpectedToken(); }
+	depth++;
 	SkipWhitespaces();
 	if ('}' == NextCharacter()) { ; } // empty object
 	else // at least need one pair
 	{
 		Retract();
-		try { obj->insert(ConsumePair()); }
+		try { InsertPair(*json, ConsumePair()); }
 		catch (exception& e)
 		{
-			Json::DestroyObjectData(*obj);
-			delete obj;
+			DeleteNode(json);
 			UnexpectedToken();
 		}
 		while (true) // * loop
@@ -589,77 +947,199 @@ Json* Json::Parser::ConsumeObject()
 			if ('}' == NextCharacter()) { break; }
 			else if (',' == character)
 			{ 
-				try { obj->insert(ConsumePair()); }
+				try { InsertPair(*json, ConsumePair()); }
 				catch (exception& e)
 				{
-					Json::DestroyObjectData(*obj);
-					delete obj;
+					DeleteNode(json);
 					UnexpectedToken();
 				}
 			}
 			else
 			{
-				Json::DestroyObjectData(*obj);
-				delete obj;
+				DeleteNode(json);
 				UnexpectedToken();
 			}
 		}
 	}
-	return new Json(obj);
+	depth--;
+	return json;
 } // end fn:ConsumeObject
 
 Json* Json::Parser::ConsumeArray()
 {
 	TRACK("Json* Json::Parser::ConsumeArray()");
-	ArrayData *arr = new ArrayData();
-	if ('[' != NextCharacter()) { UnexpectedToken(); }
+	Json *json = NewNode(arena);
+	ArrayData *arr = json->NewData<ArrayData>(json->Resource());
+	json->kind_ = kArray;
+	json->value_.data = arr;
+	if ('[' != NextCharacter()) { DeleteNode(json); UnexpectedToken(); }
+	depth++;
+	int index = 0;
 	SkipWhitespaces();
 	if (']' == NextCharacter()) { ; } // empty array
 	else // at least one value
 	{
 		Retract();
-		try { arr->push_back(ConsumeValue()); }
+		try { ConsumeItem(*arr, index++); }
 		catch (exception& e)
 		{
-			Json::DestroyArrayData(*arr);
-			delete arr;
+			DeleteNode(json);
 			UnexpectedToken();
 		}
 		while (true) // * loop
 		{
 			if (']' == NextCharacter()) { break; }
 			else if (',' == character) {
-				try { arr->push_back(ConsumeValue()); }
+				try { ConsumeItem(*arr, index++); }
 				catch(exception& e)
 				{
-					Json::DestroyArrayData(*arr);
-					delete arr;
+					DeleteNode(json);
 					UnexpectedToken();
 				}
 			}
 			else
 			{
-				Json::DestroyArrayData(*arr);
-				delete arr;
+				DeleteNode(json);
 				UnexpectedToken();
 			}
 		}
 	}
-	return new Json(arr);
+	depth--;
+	return json;
 } // end fn: Consume Array
 
 Json::Pair Json::Parser::ConsumePair()
 {
 	TRACK("Json::Parser::Pair Json::Parser::ConsumePair()");
-	Json* pkey = ConsumeString();
-	string key(pkey->AsString());
-	delete pkey;
+	bool escaped;
+	string_view key = ConsumeStringView(escaped);
+	// the value may be unescaped into token too
+	if (escaped) { keyToken = token; key = keyToken; }
 	SkipWhitespaces();
 	ConsumeSpecific(":");
+	uint64_t mask = filterMask;
+	if (mask && !filter->Match(mask, depth - 1, key, -1, filterMask))
+	{
+		SkipValue();
+		filterMask = mask;
+		return make_pair(key, (Json*)0);
+	}
 	Json *value = ConsumeValue();
+	filterMask = mask;
 	return make_pair(key, value);
 } // end fn:ConsumePair
 
+void Json::Parser::ConsumeItem(ArrayData& arr, int index)
+{
+	TRACK("void Json::Parser::ConsumeItem(ArrayData& arr, int index)");
+	uint64_t mask = filterMask;
+	if (mask && !filter->Match(mask, depth - 1, string_view(), index, filterMask))
+	{
+		SkipValue();
+		filterMask = mask;
+		return;
+	}
+	arr.push_back(ConsumeValue());
+	filterMask = mask;
+} // end fn:ConsumeItem
+
+void Json::Parser::SkipValue()
+{
+	TRACK("void Json::Parser::SkipValue()");
+	// the characters each kind of scan stops at
+	enum { kStopString = 1, kStopNested = 2, kStopScalar = 4 };
+	static const struct StopTable
+	{
+		unsigned char stop[256];
+		StopTable()
+		{
+			memset(stop, 0, sizeof(stop));
+			for (const char* c = "\"\\"; *c; ++c) { stop[(unsigned char)*c] |= kStopString; }
+			for (const char* c = "\"{}[]"; *c; ++c) { stop[(unsigned char)*c] |= kStopNested; }
+			for (const char* c = ",}] \t\r\n"; *c; ++c) { stop[(unsigned char)*c] |= kStopScalar; }
+		}
+	} table;
+
+	SkipWhitespaces();
+	const char* start = source + pos + 1;
+	const char* end = source + length;
+	const char* p = start;
+	int nesting = 0;
+	bool ok = true;
+	do
+	{
+		if (p == end) { ok = false; break; }
+		if ('\"' == *p)
+		{
+			// jump to the closing quote, over the escaped characters
+			++p;
+			while (true)
+			{
+				while (p < end && !(table.stop[(unsigned char)*p] & kStopString)) { ++p; }
+				if (p + 1 < end && '\\' == *p) { p += 2; continue; }
+				break;
+			}
+			if (p == end || '\"' != *p) { ok = false; break; }
+			++p;
+		}
+		else if ('{' == *p || '[' == *p) { ++nesting; ++p; }
+		else if ('}' == *p || ']' == *p)
+		{
+			if (0 == nesting) { ok = false; break; }
+			--nesting;
+			++p;
+		}
+		else if (nesting > 0)
+		{
+			while (p < end && !(table.stop[(unsigned char)*p] & kStopNested)) { ++p; }
+		}
+		else
+		{
+			// a number, bool or null
+			while (p < end && !(table.stop[(unsigned char)*p] & kStopScalar)) { ++p; }
+		}
+	} while (nesting > 0);
+	if (!ok || p == start)
+	{
+		pos = p - source;
+		character = p < end ? *p : '\0';
+		UnexpectedToken();
+	}
+	// stay on the last character of the value, like the consume functions do
+	pos = p - source - 1;
+	character = *(source + pos);
+	SkipWhitespaces();
+} // end fn:SkipValue
+
+unsigned int Json::Parser::ConsumeHex4()
+{
+	unsigned int code = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (!isxdigit(NextCharacter())) { UnexpectedToken(); }
+		code = (code << 4) | (isdigit(character) ? character - '0' : (tolower(character) - 'a' + 10));
+	}
+	return code;
+} // end fn:ConsumeHex4
+
+void Json::Parser::ConcatUtf8(unsigned int code)
+{
+	AppendUtf8(token, code);
+} // end fn:ConcatUtf8
+
+void Json::Parser::InsertPair(Json& object, const Pair& pair)
+{
+	if (!pair.second) { return; } // filtered out
+	// the first of duplicate keys wins
+	ObjectData& obj = *CAST_JSON_OBJ(object.value_.data);
+	if (obj.Find(pair.first) >= 0)
+	{
+		DeleteNode(pair.second);
+		return;
+	}
+	obj.Append(pair.first, pair.second);
+} // end fn:InsertPair
+
 void Json::Parser::ConsumeSpecific(const char* str)
 {
 	TRACK("void Json::Parser::ConsumeSpecific(const char* str)");
@@ -699,6 +1179,58 @@ void Json::Parser::SkipWhitespaces()
 
 void Json::Parser::UnexpectedToken() { throw Json::UnexpectedTokenException(character, pos); }
 
+/* JsonFilter */
+JsonFilter::JsonFilter(Mode mode, std::initializer_list<const char*> paths)
+	: mode_(mode), all_(0)
+{
+	for (std::initializer_list<const char*>::const_iterator cit = paths.begin(); cit != paths.end(); ++cit)
+	{
+		if (paths_.size() == 64) { break; }
+		vector<Part> parts;
+		const char* begin = *cit;
+		while (true)
+		{
+			const char* end = strchr(begin, '.');
+			Part part;
+			part.key.assign(begin, end ? end - begin : strlen(begin));
+			part.index = -1;
+			if (!part.key.empty() && strspn(part.key.c_str(), "0123456789") == part.key.size())
+			{
+				part.index = atoi(part.key.c_str());
+			}
+			parts.push_back(part);
+			if (!end) { break; }
+			begin = end + 1;
+		}
+		all_ |= (uint64_t)1 << paths_.size();
+		paths_.push_back(parts);
+	}
+}
+
+bool JsonFilter::Match(uint64_t mask, int level, string_view key, int index, uint64_t& narrowed) const
+{
+	bool whole = false;
+	narrowed = 0;
+	for (size_t i = 0; i < paths_.size(); ++i)
+	{
+		uint64_t bit = (uint64_t)1 << i;
+		if (!(mask & bit) || level >= (int)paths_[i].size()) { continue; }
+		const Part& part = paths_[i][level];
+		bool matches = ("*" == part.key) || (index >= 0 ? part.index == index : key == part.key);
+		if (!matches) { continue; }
+		if (level + 1 == (int)paths_[i].size()) { whole = true; }
+		else { narrowed |= bit; }
+	}
+	if (whole)
+	{
+		// the value itself matches a path: keep all of it or none of it
+		narrowed = 0;
+		return kAllow == mode_;
+	}
+	if (narrowed) { return true; } // on the way to a match
+	return kDeny == mode_;
+}
+
 /* Json::UnexpectedTokenException */
 Json::UnexpectedTokenException::UnexpectedTokenException(char ch, int pos)
 	:exception(), ch_(ch), pos_(pos)
@@ -725,4 +1257,318 @@ const char* Json::UnexpectedTokenException::what() const throw()
 	return msg_.c_str();
 }
 
+/* JsonPushParser */
+JsonPushParser::JsonPushParser(JsonHandler& handler) : handler_(handler)
+{
+	Reset();
+}
+
+void JsonPushParser::Reset()
+{
+	state_ = kValue;
+	stack_.clear();
+	text_.clear();
+	literal_ = 0;
+	matched_ = 0;
+	numberPos_ = 0;
+	code_ = 0;
+	high_ = 0;
+	key_ = false;
+	first_ = false;
+	offset_ = 0;
+	chunk_ = 0;
+}
+
+void JsonPushParser::Feed(string_view chunk)
+{
+	const char *p = chunk.data();
+	const char *end = p + chunk.size();
+	chunk_ = p;
+	while (p < end)
+	{
+		switch (state_)
+		{
+			case kString: p = ScanString(p, end); break;
+			case kEscape: case kUnicode: Escape(p++); break;
+			default: if (Step(p)) { ++p; } break;
+		}
+	}
+	offset_ += chunk.size();
+}
+
+void JsonPushParser::Finish()
+{
+	chunk_ = 0;
+	if (kNumber == state_) { EmitNumber(0); }
+	if (InValue()) { Fail(0); }
+}
+
+bool JsonPushParser::Step(const char* p)
+{
+	char ch = *p;
+	switch (state_)
+	{
+		case kNumber:
+		{
+			if (isdigit(ch) || '-' == ch || '+' == ch || '.' == ch || 'e' == ch || 'E' == ch)
+			{
+				text_ += ch;
+				return true;
+			}
+			// the number ended at a character of what follows it
+			EmitNumber(p);
+			return false;
+		}
+		case kLiteral:
+		{
+			if (ch != literal_[matched_]) { Fail(p); }
+			if ('\0' == literal_[++matched_])
+			{
+				if ('n' == literal_[0]) { handler_.Null(); }
+				else { handler_.Bool('t' == literal_[0]); }
+				EndValue();
+			}
+			return true;
+		}
+		default: break;
+	}
+	if (' ' == ch || '\t' == ch || '\n' == ch || '\r' == ch) { return true; }
+	switch (state_)
+	{
+		case kValue:
+		{
+			bool first = first_;
+			first_ = false;
+			switch (ch)
+			{
+				case '{': stack_ += '{'; state_ = kFirstKey; handler_.StartObject(); break;
+				case '[': stack_ += '['; first_ = true; handler_.StartArray(); break;
+				case '\"': text_.clear(); key_ = false; state_ = kString; break;
+				case 't': literal_ = "true"; matched_ = 1; state_ = kLiteral; break;
+				case 'f': literal_ = "false"; matched_ = 1; state_ = kLiteral; break;
+				case 'n': literal_ = "null"; matched_ = 1; state_ = kLiteral; break;
+				case ']':
+				{
+					if (!first) { Fail(p); }
+					stack_.pop_back();
+					handler_.EndArray();
+					EndValue();
+					break;
+				}
+				default:
+				{
+					if ('-' != ch && !isdigit(ch)) { Fail(p); }
+					text_.assign(1, ch);
+					numberPos_ = offset_ + (p - chunk_);
+					state_ = kNumber;
+					break;
+				}
+			}
+			break;
+		}
+		case kFirstKey: case kKey:
+		{
+			if ('\"' == ch) { text_.clear(); key_ = true; state_ = kString; }
+			else if ('}' == ch && kFirstKey == state_)
+			{
+				stack_.pop_back();
+				handler_.EndObject();
+				EndValue();
+			}
+			else { Fail(p); }
+			break;
+		}
+		case kColon:
+		{
+			if (':' != ch) { Fail(p); }
+			state_ = kValue;
+			break;
+		}
+		case kAfterValue:
+		{
+			char open = stack_.back();
+			if (',' == ch) { state_ = '{' == open ? kKey : kValue; }
+			else if (('}' == ch && '{' == open) || (']' == ch && '[' == open))
+			{
+				stack_.pop_back();
+				if ('{' == open) { handler_.EndObject(); }
+				else { handler_.EndArray(); }
+				EndValue();
+			}
+			else { Fail(p); }
+			break;
+		}
+		default: break;
+	}
+	return true;
+}
+
+const char* JsonPushParser::ScanString(const char* p, const char* end)
+{
+	const char *q = p;
+	while (q < end && '\"' != *q && '\\' != *q && (unsigned char)*q >= 0x20) { ++q; }
+	if (high_ && q > p)
+	{
+		// a high surrogate that is not followed by an escape stands alone
+		AppendUtf8(text_, 0xFFFD);
+		high_ = 0;
+	}
+	if (q == end)
+	{
+		// the string goes on in the next chunk
+		text_.append(p, q - p);
+		return q;
+	}
+	if ('\\' == *q)
+	{
+		text_.append(p, q - p);
+		state_ = kEscape;
+		return q + 1;
+	}
+	if ('\"' != *q) { Fail(q); } // control characters must be escaped
+	if (high_)
+	{
+		AppendUtf8(text_, 0xFFFD);
+		high_ = 0;
+	}
+	// a string that started and ended in this chunk without escapes is passed as it is
+	string_view str(p, q - p);
+	if (!text_.empty())
+	{
+		text_.append(p, q - p);
+		str = text_;
+	}
+	if (key_)
+	{
+		handler_.Key(str);
+		state_ = kColon;
+	}
+	else
+	{
+		handler_.String(str);
+		EndValue();
+	}
+	return q + 1;
+}
+
+void JsonPushParser::Escape(const char* p)
+{
+	char ch = *p;
+	if (kUnicode == state_)
+	{
+		if (!isxdigit(ch)) { Fail(p); }
+		code_ = (code_ << 4) | (isdigit(ch) ? ch - '0' : (tolower(ch) - 'a' + 10));
+		if (++matched_ < 4) { return; }
+		state_ = kString;
+		unsigned int code = code_;
+		if (high_)
+		{
+			// a surrogate pair makes up one code point
+			if (code >= 0xDC00 && code <= 0xDFFF) { code = 0x10000 + ((high_ - 0xD800) << 10) + (code - 0xDC00); }
+			else { AppendUtf8(text_, 0xFFFD); }
+			high_ = 0;
+		}
+		else if (code >= 0xD800 && code <= 0xDBFF)
+		{
+			high_ = code;
+			return;
+		}
+		if (code >= 0xD800 && code <= 0xDFFF) { code = 0xFFFD; }
+		AppendUtf8(text_, code);
+		return;
+	}
+	if (high_ && 'u' != ch)
+	{
+		AppendUtf8(text_, 0xFFFD);
+		high_ = 0;
+	}
+	state_ = kString;
+	switch (ch)
+	{
+		case '\"': text_ += '\"'; break;
+		case '\\': text_ += '\\'; break;
+		case '/': text_ += '/'; break;
+		case 'b': text_ += '\b'; break;
+		case 'f': text_ += '\f'; break;
+		case 'n': text_ += '\n'; break;
+		case 'r': text_ += '\r'; break;
+		case 't': text_ += '\t'; break;
+		case 'u': code_ = 0; matched_ = 0; state_ = kUnicode; break;
+		default: Fail(p);
+	}
+}
+
+void JsonPushParser::EmitNumber(const char* p)
+{
+	// the same grammar as Json::Parser::ConsumeNumber()
+	const char *first = text_.data();
+	const char *last = first + text_.size();
+	const char *c = first;
+	bool integral = true;
+	if (c < last && '-' == *c) { ++c; }
+	if (c == last || !isdigit(*c)) { BadNumber(c, p); }
+	if ('0' == *c) { ++c; }
+	else { while (c < last && isdigit(*c)) { ++c; } }
+	if (c < last && '.' == *c)
+	{
+		integral = false;
+		if (++c == last || !isdigit(*c)) { BadNumber(c, p); }
+		while (c < last && isdigit(*c)) { ++c; }
+	}
+	if (c < last && ('e' == *c || 'E' == *c))
+	{
+		integral = false;
+		if (++c < last && ('+' == *c || '-' == *c)) { ++c; }
+		if (c == last || !isdigit(*c)) { BadNumber(c, p); }
+		while (c < last && isdigit(*c)) { ++c; }
+	}
+	if (c != last) { BadNumber(c, p); }
+	int64_t integer;
+	double number;
+	string scratch;
+	if (ConvertNumber(first, last, integral, integer, number, scratch)) { handler_.Integer(integer); }
+	else { handler_.Double(number); }
+	EndValue();
+}
+
+void JsonPushParser::EndValue()
+{
+	if (stack_.empty())
+	{
+		state_ = kValue;
+		handler_.EndDocument();
+	}
+	else { state_ = kAfterValue; }
+}
+
+void JsonPushParser::BadNumber(const char* c, const char* p)
+{
+	if (c == text_.data() + text_.size()) { Fail(p); }
+	throw SyntaxError(*c, numberPos_ + (c - text_.data()));
+}
+
+void JsonPushParser::Fail(const char* p)
+{
+	if (!p || !chunk_) { throw SyntaxError('\0', offset_); }
+	throw SyntaxError(*p, offset_ + (p - chunk_));
+}
+
+/* JsonPushParser::SyntaxError */
+JsonPushParser::SyntaxError::SyntaxError(char ch, int64_t pos)
+{
+	ostringstream oss;
+	if ('\0' == ch)
+	{
+		oss << "SyntaxError: Unexpected end of input";
+	}
+	else
+	{
+		oss << "SyntaxError: Unexpected token ";
+		if (isgraph(ch)) { oss << ch; }
+		else { oss << (int)ch << "(ASCII)"; }
+		oss << " at pos " << pos;
+	}
+	msg_ = oss.str();
+}
+
 }
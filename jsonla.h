@@ -10,13 +10,110 @@
 #endif
 
 #include <iostream>
-#include <typeinfo>
 #include <string>
 #include <vector>
-#include <map>
+#include <atomic>
+#include <memory_resource>
+#include <string_view>
+#include <initializer_list>
+#include <stdint.h>
 
 namespace ggicci
 {
+/**
+ * \brief A monotonic arena that holds every node, container and string of a json document.
+ * \details Memory handed out by the arena is never freed one piece at a time. The whole
+ * 			arena is dropped at once when the last Json that owns it goes away, so tearing
+ * 			down a document costs the same no matter how many values it holds.
+ * 			The arena itself is not thread-safe, a document should be built by one thread
+ * 			at a time. The reference count is, so documents can be handed between threads.
+ */
+	class JsonArena : public std::pmr::monotonic_buffer_resource
+	{
+	public:
+		JsonArena() : std::pmr::monotonic_buffer_resource(kFirstBlockSize), refs_(0) { }
+
+		/**
+		 * \brief Take a reference on the arena.
+		 */
+		void AddRef() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+		/**
+		 * \brief Drop a reference, the arena deletes itself with the last one.
+		 */
+		void Release()
+		{
+			if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) { delete this; }
+		}
+
+	private:
+		static const size_t kFirstBlockSize = 16 * 1024;
+
+		std::atomic<int> refs_;	///< number of Json objects owning this arena
+	};
+
+/**
+ * \brief A list of paths that decides which values of a json structural string get parsed.
+ * \details A path names a value by the keys (or array indexes) leading to it, separated by
+ * 			dots, eg. "formats.*.fragments". A \b * matches any key or index.
+ * 			With a deny filter the values matching one of the paths are skipped. With an
+ * 			allow filter only the values matching one of the paths are kept, together with
+ * 			the objects and arrays on the way to them. Skipped values are scanned over
+ * 			without being parsed or allocated, skipped array items leave no hole behind.
+ * \note At most 64 paths per filter.
+ *
+ * \code{.cpp}
+ * JsonFilter filter(JsonFilter::kDeny, {"subtitles", "formats.*.fragments"});
+ * Json info = Json::Parse(line, filter);
+ * \endcode
+ */
+	class JsonFilter
+	{
+	public:
+		/**
+		 * \brief Whether the paths are the values to skip or the values to keep.
+		 */
+		enum Mode
+		{
+			kDeny,	///< skip the values matching a path
+			kAllow	///< keep only the values matching a path
+		};
+
+		JsonFilter(Mode mode, std::initializer_list<const char*> paths);
+
+		/**
+		 * \brief A mask with a bit set for every path, where the matching starts from.
+		 */
+		uint64_t AllPaths() const { return all_; }
+
+		/**
+		 * \brief Decide whether a value of an object or array gets parsed.
+		 *
+		 * @param  mask     the paths that matched every level above the value
+		 * @param  level    how many objects and arrays the value is nested in, minus one
+		 * @param  key      the key of the value, empty for array items
+		 * @param  index    the index of an array item, -1 for object values
+		 * @param  narrowed set to the paths that still have to be checked below the value,
+		 * 					0 when everything below it is kept
+		 * @return          false to skip the value
+		 */
+		bool Match(uint64_t mask, int level, std::string_view key, int index, uint64_t& narrowed) const;
+
+	private:
+		/**
+		 * \brief One key (or index) of a path.
+		 */
+		struct Part
+		{
+			std::string key;	///< the key, or "*"
+			int index;			///< the key as an array index, -1 if it is not a number
+		};
+
+		Mode mode_;
+		uint64_t all_;
+		std::vector<std::vector<Part> > paths_;
+	};
+
 /**
  * \brief A Json Parser and Manipulator.
  * \details This class is used to parse a json structural string. After parsing,
@@ -72,7 +169,86 @@ namespace ggicci
 		 * }
 		 * \endcode
 		 */
-		static Json Parse(const char* json_string);
+		static Json Parse(std::string_view json_string);
+
+		/**
+		 * \brief Parse a json structural string into a document.
+		 *
+		 * When \em document is true, the returned Json owns a new JsonArena and every value
+		 * of the tree is allocated from it. Everything later added to the tree (AddProperty,
+		 * Push, assignment to one of its values) is copied into the same arena. Removed
+		 * values are not freed until the document goes away, and then the arena is
+		 * dropped as a whole instead of freeing the tree node by node.
+		 * \note Copying a document (or one of its values) into a Json that is not part of
+		 * 		 it makes an ordinary heap allocated copy.
+		 * @param  json_string json structural string
+		 * @param  document    whether to allocate the tree in an arena
+		 * @return             a Json instance
+		 *
+		 * \code{.cpp}
+		 * Json info = Json::Parse(line, true);
+		 * info.Remove("formats"); // nothing is freed here
+		 * \endcode
+		 */
+		static Json Parse(std::string_view json_string, bool document);
+
+		/**
+		 * \brief Parse a json structural string into the arena of an existing document.
+		 *
+		 * The returned Json shares the arena of \em document (it keeps the arena alive on its
+		 * own), so pushing or adding it to \em document only copies nodes within that arena.
+		 * If \em document is not an arena document, this is the same as Parse(json_string).
+		 * @param  json_string json structural string
+		 * @param  document    a Json returned by Parse(json_string, true) or one of its values
+		 * @return             a Json instance
+		 *
+		 * \code{.cpp}
+		 * Json list = Json::Parse("[]", true);
+		 * list.Push(Json::Parse(line, list));
+		 * \endcode
+		 */
+		static Json Parse(std::string_view json_string, const Json& document);
+
+		/**
+		 * \brief Parse a json structural string, skipping the values \em filter says to skip.
+		 *
+		 * Skipped values are still checked to be well-bracketed, but nothing is allocated
+		 * for them, so parsing a big document to keep a small part of it only costs a scan
+		 * over the rest.
+		 * \see JsonFilter
+		 * @param  json_string json structural string
+		 * @param  filter      the paths to skip or to keep
+		 * @param  document    whether to allocate the tree in an arena
+		 * @return             a Json instance
+		 */
+		static Json Parse(std::string_view json_string, const JsonFilter& filter, bool document = false);
+
+		/**
+		 * \brief Parse a json structural string into the arena of an existing document,
+		 * skipping the values \em filter says to skip.
+		 * \see Parse(const char*, const Json&)
+		 */
+		static Json Parse(std::string_view json_string, const JsonFilter& filter, const Json& document);
+
+		/**
+		 * \brief Parse a json structural string in situ.
+		 *
+		 * Long strings without escape sequences are not copied, the values keep pointing into
+		 * \em json_string (short ones are held in the value itself either way). The buffer must therefore outlive the returned Json and any value
+		 * moved out of it. Copying a value (copy constructor, copy assignment, Push or
+		 * AddProperty of a const reference) makes it own its strings again.
+		 * @param  json_string json structural string, it does not need to be NUL-terminated
+		 * @param  document    a document to allocate the values from, or any other Json for the heap
+		 * @param  filter      the values to skip, or 0 to parse everything
+		 * @return             a Json instance
+		 *
+		 * \code{.cpp}
+		 * string_view frame = ...;
+		 * Json msg = Json::ParseInSitu(frame, Json());
+		 * string url = msg["url"].AsString(); // copies out of the frame
+		 * \endcode
+		 */
+		static Json ParseInSitu(std::string_view json_string, const Json& document, const JsonFilter* filter = 0);
 
 		/**
 		 * \brief Construct a Json object represents null.
@@ -91,6 +267,11 @@ namespace ggicci
 		 */
 		explicit Json(int num);
 
+		/**
+		 * \brief Construct a Json object from a 64-bit integer, it is kept exact.
+		 */
+		explicit Json(int64_t num);
+
 		/**
 		 * \brief Construct a Json object from \b double.
 		 */
@@ -129,9 +310,26 @@ namespace ggicci
 		Json& operator = (const Json& rhs);
 
 		/**
-		 * \brief Destructor to delete a Json object.
+		 * \brief Move constructor, takes over the data of \em rhs without copying it.
+		 *
+		 * \em rhs is left null. If \em rhs is a value inside a document, the new Json
+		 * keeps the document's arena alive on its own.
+		 * @param rhs another Json object.
+		 */
+		Json(Json&& rhs) noexcept;
+
+		/**
+		 * \brief Move assignment, takes over the data of \em rhs without copying it.
+		 *
+		 * \em rhs is left null. If this Json object is a value inside a document and \em rhs
+		 * does not live in the same arena, the values of \em rhs are copied into the arena.
 		 */
-		virtual ~Json();
+		Json& operator = (Json&& rhs);
+
+		/**
+		 * \brief Destructor to delete a Json object. Not virtual, a node is kept as small as possible.
+		 */
+		~Json();
 
 		/**
 		 * \brief Get the enum value of this Json object, which indicates
@@ -170,7 +368,7 @@ namespace ggicci
 		 * \see Json()
 		 * @return true means it's null
 		 */
-		bool IsNull() const { return !data_; }
+		bool IsNull() const { return kind_ == kNull; }
 
 		/**
 		 * \brief Test whether this Json object represents an array.
@@ -184,6 +382,13 @@ namespace ggicci
 		 */
 		bool IsObject() const { return kind_ == kObject; }
 
+		/**
+		 * \brief Test whether this Json object lives in a document arena.
+		 * \see Parse(const char*, bool)
+		 * @return true means its values are allocated from a JsonArena
+		 */
+		bool IsDocument() const { return arena_ != 0; }
+
 		/**
 		 * \brief Test whether an object or array holds values.
 		 * @return true if no values in an object or array
@@ -241,6 +446,7 @@ namespace ggicci
 		 * If this Json object represents an object (parsed from "{...}"), it
 		 * will have some KVPs (or maybe none), then use this function you can
 		 * retrieve all the keys (names) in a std::vector.
+		 * The keys come in the order they were inserted (or parsed).
 		 * \note An empty vector will be returned if it's not an object Json object.
 		 * @return a std::vector contains all the keys
 		 * 
@@ -255,9 +461,9 @@ namespace ggicci
 		 * \endcode
 		 * \b Output:
 		 * \code{.txt}
-		 * birthday: [ 1991, 11, 10 ]
 		 * id: 1234
 		 * name: "Ggicci"
+		 * birthday: [ 1991, 11, 10 ]
 		 * \endcode
 		 */
 		std::vector<std::string> Keys() const;
@@ -284,6 +490,12 @@ namespace ggicci
 		 */
 		Json& Push(const Json& rhs);
 
+		/**
+		 * \brief Push a Json object to the current Json object by moving it.
+		 * \see Push(const Json&)
+		 */
+		Json& Push(Json&& rhs);
+
 		/**
 		 * \brief AddProperty a Json object to the current Json object (finally an object).
 		 *
@@ -303,12 +515,18 @@ namespace ggicci
 		 * json.AddProperty("characteristics", Json::Parse("[\"optimitic\", \"sympathetic\"]"));
 		 * cout << json.ToString() << endl;
 		 * // output:
-		 * // { "characteristics": [ "optimitic", "sympathetic" ], "name": "Ggicci" }
+		 * // { "name": "Ggicci", "characteristics": [ "optimitic", "sympathetic" ] }
 		 * \endcode
 		 * 
 		 */
 		Json& AddProperty(const std::string& key, const Json& value);
 
+		/**
+		 * \brief AddProperty a Json object to the current Json object by moving it.
+		 * \see AddProperty(const std::string&, const Json&)
+		 */
+		Json& AddProperty(const std::string& key, Json&& value);
+
 		/**
 		 * \brief Remove a specefied KVP(key-value pair) from an object Json object by key(name).
 		 *
@@ -354,6 +572,14 @@ namespace ggicci
 		 */
 		int AsInt() const;
 
+		/**
+		 * \brief Extract the data from number Json object and return it as a 64-bit integer.
+		 * \details Integers in the json text (no fraction, no exponent) that fit in 64 bits
+		 * 			are kept exact, so eg. file sizes come back as they were written.
+		 * \note Exception when Json object is not a number.
+		 */
+		int64_t AsInt64() const;
+
 		/**
 		 * \brief Extract the data from number Json object and return it as \b double.
 		 * \note Exception when Json object is not a number.
@@ -411,6 +637,11 @@ namespace ggicci
 		 */
 		Json& operator = (int num);
 
+		/**
+		 * \brief Assignment from a 64-bit integer, finally become a number.
+		 */
+		Json& operator = (int64_t num);
+
 		/**
 		 * \brief Assignment from \b double, finally become a number.
 		 */
@@ -439,21 +670,76 @@ namespace ggicci
 		 * For example, if this Json object represents an object, and it has
 		 * a KVP named "id" and its value is 194024, then you will get a json
 		 * string like this: <b>{ "id": 194024 }</b>.
+		 * \see Write()
 		 * @return the json structural string
 		 */
 		std::string ToString() const;
 
-		//**** same as ToString() but with the order of insertion
+		//**** same as ToString() but without the padding spaces
 		std::string ToStringOrderedTrimmed() const;
 
+		/**
+		 * \brief Append the json structural string of this Json object to \em out.
+		 *
+		 * The whole tree is written in one pass into \em out, so a caller that knows roughly
+		 * how big the result will be can reserve it up front, or write straight into the
+		 * buffer the result is going to be sent from. Strings are escaped, and the members of
+		 * objects are written in the order they were inserted (or parsed).
+		 * @param out     the buffer to append to
+		 * @param compact whether to leave out the padding spaces, eg. <b>{"id":194024}</b>
+		 *
+		 * \code{.cpp}
+		 * string frame;
+		 * frame.reserve(4096);
+		 * json.Write(frame, true);
+		 * \endcode
+		 */
+		void Write(std::string& out, bool compact = false) const;
+
 	private:
 		#define CAST_JSON_OBJ(DATA) (static_cast<ObjectData*>(DATA))
 		#define CAST_JSON_ARR(DATA) (static_cast<ArrayData*>(DATA))
 
-		typedef std::vector<Json*> ArrayData;
-		typedef std::map<std::string, Json*> ObjectData;
-		typedef std::map<int, std::string> ObjectOrder;
-		typedef std::pair<std::string, Json*> Pair;
+		typedef std::pmr::string StringData;
+		typedef std::pmr::vector<Json*> ArrayData;
+		typedef std::pair<StringData, Json*> ObjectEntry;
+
+		/**
+		 * \brief The members of an object, kept in one block in the order they were inserted.
+		 * \details Most objects have a handful of keys, those are looked up by scanning the
+		 * 			entries. Objects that grow past kIndexThreshold keys get an open addressing
+		 * 			table of entry positions on top, so lookups stay cheap for big ones too.
+		 */
+		struct ObjectData
+		{
+			static const size_t kIndexThreshold = 16;
+
+			std::pmr::vector<ObjectEntry> entries;	///< the members in insertion order
+			std::pmr::vector<int> index;			///< positions in \em entries by key hash, empty for small objects
+
+			explicit ObjectData(std::pmr::memory_resource* resource) : entries(resource), index(resource) { }
+
+			/**
+			 * \brief The position of \em key in \em entries, or -1 if there is no such member.
+			 */
+			int Find(std::string_view key) const;
+
+			/**
+			 * \brief Add a member, the caller makes sure \em key is not in the object yet.
+			 */
+			void Append(std::string_view key, Json* value);
+
+			/**
+			 * \brief Remove the member at \em pos, the value is left to the caller.
+			 */
+			void Erase(int pos);
+
+		private:
+			void Reindex();
+			void IndexEntry(int pos);
+		};
+
+		typedef std::pair<std::string_view, Json*> Pair;
 
 		/**
 		 * \brief A nested struct who does the real parsing job.
@@ -466,8 +752,15 @@ namespace ggicci
 		struct Parser
 		{
 			const char* source;		///< the json structural string need to be parsed
+			int			length;		///< the length of \em source, there is no NUL at its end
+			bool		insitu;		///< whether strings without escapes point into \em source
+			JsonArena*	arena;		///< where the parsed values are allocated, or 0 for the heap
+			const JsonFilter* filter;	///< which values to skip, or 0 to parse everything
+			uint64_t	filterMask;	///< the paths of \em filter matching the value being parsed
+			int			depth;		///< how many objects and arrays we are in
 			int			pos;		///< current position(index) of the character in \em source
 			unsigned char character;///< current character scanned at
+			std::string	keyToken;	///< an object key that had to be unescaped
 			std::string	token;		///< appear as a word, finally it will be parsed to correspoding
 									///< data structure
 									///< ~~~
@@ -481,7 +774,7 @@ namespace ggicci
 			/**
 			 * Constructor
 			 */
-			Parser(const char* json_string);
+			Parser(std::string_view json_string, JsonArena* arena, const JsonFilter* filter = 0, bool insitu = false);
 
 			/**
 			 * \brief Parse a \b Value.
@@ -511,6 +804,16 @@ namespace ggicci
 			 */
 			Json* ConsumeString();
 
+			/**
+			 * \brief Parse the characters of a \b string.
+			 *
+			 * A string without escape sequences is returned as a view of \em source, otherwise
+			 * it is unescaped into \em token and a view of \em token is returned.
+			 * @param  escaped set to whether the string had escape sequences
+			 * @return         the characters of the string
+			 */
+			std::string_view ConsumeStringView(bool& escaped);
+
 			/**
 			 * \brief Parse a \b bool(true or false).
 			 * @return the bool Json object parsed
@@ -549,6 +852,24 @@ namespace ggicci
 			 */
 			Json::Pair ConsumePair();
 
+			/**
+			 * \brief Parse an item of an \b array and push it to \em arr, unless it is filtered out.
+			 */
+			void ConsumeItem(ArrayData& arr, int index);
+
+			/**
+			 * \brief Scan over a \b value without parsing it.
+			 *
+			 * Only the brackets and the quotes are looked at, nothing is allocated.
+			 */
+			void SkipValue();
+
+			/**
+			 * \brief Insert a parsed \b pair into an object, dropping the value of a duplicate key.
+			 * A pair whose value was filtered out is left out.
+			 */
+			void InsertPair(Json& object, const Pair& pair);
+
 			/**
 			 * \brief Consume a specified string in the \em source.
 			 * \note If the string not found in \em source, it will throw an exception
@@ -568,6 +889,17 @@ namespace ggicci
 			 */
 			void Concat() { token += character; }
 
+			/**
+			 * \brief Concat the UTF-8 encoding of the code point \em code to \em token.
+			 */
+			void ConcatUtf8(unsigned int code);
+
+			/**
+			 * \brief Consume the 4 hex digits of a \\u escape.
+			 * @return the code unit they represent
+			 */
+			unsigned int ConsumeHex4();
+
 			/**
 			 * \brief Scan backward a step(one character distance).
 			 */
@@ -577,7 +909,7 @@ namespace ggicci
 			 * \brief Whether it is the end-of-line.
 			 * @return true if EOL.
 			 */
-			bool EOL() const { return '\0' == character; }
+			bool EOL() const { return pos >= length; }
 
 			/**
 			 * \brief Scan forward a step(one character distance).
@@ -585,8 +917,9 @@ namespace ggicci
 			 */
 			char NextCharacter()
 			{
-				if (pos >= 0 && '\0' == *(source + pos)) { UnexpectedToken(); }
-				character = *(source + (++pos));
+				if (pos >= length) { UnexpectedToken(); }
+				++pos;
+				character = pos < length ? *(source + pos) : '\0';
 				return character;
 			}
 
@@ -643,68 +976,321 @@ namespace ggicci
 		static void DestroyArrayData(ArrayData& arr);
 
 		/**
-		 * \brief Delete Json object in an object (map)
+		 * \brief Delete Json object in an object
 		 */
 		static void DestroyObjectData(ObjectData& obj);
 
 		/**
-		 * \brief Construct from a Json object pointed by /em rhs
+		 * \brief Construct a null value that belongs to \em arena (or the heap if 0).
 		 */
-		explicit Json(Json* rhs);
+		explicit Json(JsonArena* arena);
 
 		/**
-		 * \brief Consturct from a map
+		 * \brief Parse into \em arena, the returned root owns a reference on it.
 		 */
-		explicit Json(ObjectData* obj);
+		static Json ParseIn(std::string_view json_string, JsonArena* arena, const JsonFilter* filter = 0, bool insitu = false);
 
 		/**
-		 * \brief Construct from a vector
+		 * \brief Allocate a null value next to this one (same arena or the heap).
 		 */
-		explicit Json(ArrayData* arr);
+		static Json* NewNode(JsonArena* arena);
+
+		/**
+		 * \brief Delete a value allocated by NewNode(). Arena values are left to the arena.
+		 */
+		static void DeleteNode(Json* json);
+
+		/**
+		 * \brief Allocate data of type \em T in this value's arena or on the heap.
+		 */
+		template <typename T, typename... Args>
+		T* NewData(Args&&... args) const
+		{
+			if (!arena_) { return new T(std::forward<Args>(args)...); }
+			return new (arena_->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		}
+
+		/**
+		 * \brief Free data allocated by NewData(). Arena data is left to the arena.
+		 */
+		template <typename T>
+		void DeleteData(T* data) const
+		{
+			if (!arena_) { delete data; }
+		}
+
+		/**
+		 * \brief The allocator for the containers and strings of this value.
+		 */
+		std::pmr::memory_resource* Resource() const
+		{
+			if (arena_) { return arena_; }
+			return std::pmr::new_delete_resource();
+		}
 
 		/**
 		 * \brief Deep copy work.
 		 */
 		void DoDeepCopy(const Json& rhs);
 
+		/**
+		 * \brief Append \em str to \em out as a quoted and escaped json string.
+		 */
+		static void WriteString(std::string& out, const char* str, size_t len);
+
+		/**
+		 * \brief The characters of a string value, wherever they are held.
+		 */
+		std::string_view StringValue() const
+		{
+			if (store_ == kInlineString) { return std::string_view(value_.chars, inlineSize_); }
+			return std::string_view(value_.str.ptr, value_.str.size);
+		}
+
+		/**
+		 * \brief Turn this value into a copy of \em str. Short strings are kept in the node itself.
+		 */
+		void SetString(std::string_view str);
+
+		/**
+		 * \brief Take over the data (and the arena reference) of \em rhs, leaving it null.
+		 */
+		void DoMove(Json& rhs);
+
+		/**
+		 * \brief Append a null value to the array (converting to one first). Return the new value.
+		 */
+		Json& PushNull();
+
 		/**
 		 * \brief Release memory of a Json object.
 		 */
 		void Release();
 
 		/**
-		 * \brief Convert data to specified type. Return the reference.
+		 * \brief Take over the value of \em rhs as it is, leaving it null. Both must share an arena.
 		 */
-		template <typename ToType>
-		ToType& Data()
+		void TakeValue(Json& rhs)
 		{
-			return const_cast<ToType&>(static_cast<const Json&>(*this).Data<ToType>());
+			kind_ = rhs.kind_;
+			value_ = rhs.value_;
+			store_ = rhs.store_;
+			inlineSize_ = rhs.inlineSize_;
+			rhs.kind_ = kNull;
 		}
 
 		/**
-		 * \brief Convert data to specified type. Return the reference.
+		 * \brief The elements of an array value, throws BadConversionException for other kinds.
 		 */
-		template <typename ToType>
-		const ToType& Data() const
+		ArrayData& Array() const
 		{
-			bool okay;
-			switch(kind_)
-			{
-			case kNumber: okay = (typeid(double) == typeid(ToType)); break;
-			case kString: okay = (typeid(std::string) == typeid(ToType)); break;
-			case kBool: okay = (typeid(bool) == typeid(ToType)); break;
-			case kArray: okay = (typeid(ArrayData) == typeid(ToType)); break;
-			case kObject: okay = (typeid(ObjectData) == typeid(ToType)); break;
-			default: okay = false;
-			}
-			if (!okay) throw BadConversionException();
-			return *static_cast<ToType*>(data_);
+			if (kind_ != kArray) { throw BadConversionException(); }
+			return *CAST_JSON_ARR(value_.data);
 		}
-		
-		Kind kind_;		///< which kind of data this Json object represents
-		void *data_;	///< the real data held by the Json object
-		ObjectOrder order_;		///***order of stuff in this object
-		int lastInsertId_;
+
+		/**
+		 * \brief The members of an object value, throws BadConversionException for other kinds.
+		 */
+		ObjectData& Object() const
+		{
+			if (kind_ != kObject) { throw BadConversionException(); }
+			return *CAST_JSON_OBJ(value_.data);
+		}
+
+		/**
+		 * \brief How the characters of a string value are held.
+		 */
+		enum StringStore
+		{
+			kInlineString,		///< in the node itself, see kInlineCapacity
+			kOwnedString,		///< in a block allocated for this value, from the arena or the heap
+			kBorrowedString		///< in the buffer the value was parsed from
+		};
+
+		/**
+		 * \brief How a number value is held.
+		 */
+		enum NumberStore
+		{
+			kDoubleNumber,		///< in \em number
+			kIntegerNumber		///< in \em integer, exact
+		};
+
+		static const size_t kInlineCapacity = 16;
+
+		/**
+		 * \brief The payload of a node. Scalars are held right here, only arrays, objects
+		 * 		  and long strings need memory of their own.
+		 */
+		union Value
+		{
+			double number;
+			int64_t integer;
+			bool boolean;
+			void *data;		///< the ArrayData or ObjectData
+			struct { const char *ptr; size_t size; } str;	///< an owned or borrowed string
+			char chars[kInlineCapacity];	///< an inline string
+		};
+
+		Value value_;			///< the data held by the Json object, which member is live depends on \em kind_
+		JsonArena *arena_;		///< the document arena this value is allocated from, 0 for the heap
+		Kind kind_;				///< which kind of data this Json object represents
+		unsigned char store_;	///< the StringStore of a string value, or the NumberStore of a number
+		unsigned char inlineSize_;	///< the length of an inline string
+		bool ownsArena_;		///< whether this value holds a reference on \em arena_
+	};
+
+/**
+ * \brief Receives the events of a JsonPushParser.
+ * \details Every event has an empty default, override the ones you need. A handler may
+ * 			throw to stop the parsing, the exception comes out of JsonPushParser::Feed().
+ * 			The views passed to Key() and String() are only valid during the call.
+ */
+	class JsonHandler
+	{
+	public:
+		virtual ~JsonHandler() { }
+
+		virtual void StartObject() { }
+		virtual void EndObject() { }
+		virtual void StartArray() { }
+		virtual void EndArray() { }
+		virtual void Key(std::string_view /*key*/) { }
+		virtual void String(std::string_view /*str*/) { }
+		virtual void Integer(int64_t /*num*/) { }	///< a number without fraction or exponent that fits in 64 bits
+		virtual void Double(double /*num*/) { }		///< any other number
+		virtual void Bool(bool /*boo*/) { }
+		virtual void Null() { }
+
+		/**
+		 * \brief A top level value is complete. Another one may follow (json lines).
+		 */
+		virtual void EndDocument() { }
+	};
+
+/**
+ * \brief An event based json parser that is fed the input in chunks of any size.
+ * \details The parser keeps its state between the chunks, a value may be split anywhere,
+ * 			even in the middle of a string, a number or an escape sequence. Nothing but the
+ * 			nesting and the string or number being read is held, so outputs of any size
+ * 			can be checked or transformed without building a Json of them. Several top level
+ * 			values may follow each other separated by whitespace, like json lines.
+ * \note A number at the very end of the input can only be told complete by Finish().
+ *
+ * \code{.cpp}
+ * struct Counter : JsonHandler { int n = 0; void EndDocument() { n++; } } counter;
+ * JsonPushParser parser(counter);
+ * while (int len = read(fd, buf, sizeof(buf))) { parser.Feed(std::string_view(buf, len)); }
+ * parser.Finish();
+ * \endcode
+ */
+	class JsonPushParser
+	{
+	public:
+		explicit JsonPushParser(JsonHandler& handler);
+
+		/**
+		 * \brief Parse the next chunk of the input, calling the handler for every complete event.
+		 * \note Throws SyntaxError on malformed input. The parser has to be Reset() afterwards.
+		 */
+		void Feed(std::string_view chunk);
+
+		/**
+		 * \brief Tell the parser the input is over.
+		 * \note Throws SyntaxError if it ended in the middle of a value.
+		 */
+		void Finish();
+
+		/**
+		 * \brief Forget everything fed so far and start over.
+		 */
+		void Reset();
+
+		/**
+		 * \brief Whether a top level value has been started but not completed yet.
+		 */
+		bool InValue() const { return state_ != kValue || !stack_.empty(); }
+
+		/**
+		 * \brief Exception indicates syntax error of the input.
+		 */
+		struct SyntaxError : std::exception
+		{
+		public:
+			SyntaxError(char ch, int64_t pos);
+			const char* what() const throw() { return msg_.c_str(); }
+		private:
+			std::string msg_;	///< error message
+		};
+
+	private:
+		/**
+		 * \brief What the parser expects next.
+		 */
+		enum State
+		{
+			kValue,			///< a value, or the end of an empty array
+			kFirstKey,		///< a key, or the end of an empty object
+			kKey,			///< a key
+			kColon,			///< the colon after a key
+			kAfterValue,	///< a comma, or the end of the enclosing object or array
+			kString,		///< the characters of a string (or key)
+			kEscape,		///< the character after a backslash
+			kUnicode,		///< the hex digits of a \\u escape
+			kNumber,		///< the characters of a number
+			kLiteral		///< the rest of true, false or null
+		};
+
+		/**
+		 * \brief Handle one character outside of strings. Return false to see it again.
+		 */
+		bool Step(const char* p);
+
+		/**
+		 * \brief Consume the characters of a string up to \em end. Return where it stopped.
+		 */
+		const char* ScanString(const char* p, const char* end);
+
+		/**
+		 * \brief Handle one character of an escape sequence.
+		 */
+		void Escape(const char* p);
+
+		/**
+		 * \brief Convert the number in \em text_ and pass it to the handler.
+		 * @param p the character that ended the number, 0 at the end of the input
+		 */
+		void EmitNumber(const char* p);
+
+		/**
+		 * \brief A value was completed, decide what comes next.
+		 */
+		void EndValue();
+
+		/**
+		 * \brief Throw SyntaxError for the character at \em p of the current chunk, or 0 for the end.
+		 */
+		void Fail(const char* p);
+
+		/**
+		 * \brief Throw SyntaxError for the character at \em c of a malformed number in \em text_.
+		 * If the number is cut short, the blame goes to \em p which ended it.
+		 */
+		void BadNumber(const char* c, const char* p);
+
+		JsonHandler& handler_;
+		State state_;
+		std::string stack_;		///< a '{' or '[' for every open object or array
+		std::string text_;		///< the string or number read so far
+		const char *literal_;	///< the literal being matched in kLiteral
+		int matched_;			///< how many characters of \em literal_ matched, or of the \\u digits
+		unsigned int code_;		///< the \\u code unit being read
+		unsigned int high_;		///< a high surrogate waiting for its low half, or 0
+		bool key_;				///< whether the string being read is a key
+		bool first_;			///< whether kValue may see the end of an empty array
+		int64_t numberPos_;		///< where the number being read started
+		int64_t offset_;		///< how many bytes came before the current chunk
+		const char *chunk_;		///< the current chunk, for error positions
 	};
 
 }
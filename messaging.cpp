@@ -1,7 +1,20 @@
 #include "messaging.h"
 #include <string>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include "utils.h"
+#include "frame_reader.h"
+#include "recorder.h"
 #include "exceptions.h"
 #include "defines.h"
 #include <plog/Log.h>
@@ -10,9 +23,43 @@
 using namespace std;
 using namespace ggicci;
 
+static void sendFrame(string &frame, message_lane lane, const string &dlHash, bool droppable);
+static void sendChunked(const string &content, message_lane lane, const string &dlHash);
+static string makeChunk(string_view content, size_t &pos, unsigned int chunkId, int index);
+static void enqueue(string &content, message_lane lane, const string &dlHash, bool droppable, bool accepted = false);
+static void dropQueued(const string &dlHash);
+static message_lane laneAfter(const string &dlHash, message_lane lane);
+static void writer_th();
 
-std::mutex theMutex;
-std::time_t lastSentTime = 0;
+
+struct outbound_frame
+{
+	uint32_t length;
+	std::string content;
+	std::string dlHash;
+	bool droppable;
+};
+
+const int LANE_COUNT = 3;
+const size_t OUTBOUND_QUEUE_MAX_BYTES = 32 * NATIVE_MESSAGE_MAX_LEN;
+//how much of an outbound frame is written to the log
+const size_t LOG_FRAME_LEN = 512;
+
+struct outbound_queue
+{
+	std::mutex mutex;
+	std::condition_variable outCond;
+	std::condition_variable flushCond;
+	std::deque<outbound_frame> lanes[LANE_COUNT];
+	size_t queuedBytes = 0;
+	bool writing = false;
+};
+
+//never destroyed because the detached writer thread is still waiting on it while the process exits
+outbound_queue &outQueue = *new outbound_queue();
+std::once_flag writerStarted;
+std::atomic<unsigned int> lastChunkId(0);
+frame_reader stdinReader(STDIN_FILENO, NATIVE_MESSAGE_IN_MAX_LEN);
 
 
 messaging::messaging(void)
@@ -23,105 +70,439 @@ messaging::~messaging(void)
 {
 }
 
-// Read a message from stdin and decode it.
-string messaging::get_message() 
+// Read whatever is available on stdin into the input buffer
+// returns false when the browser has closed our stdin
+bool messaging::readInput()
+{
+	return stdinReader.fill();
+}
+
+// Take the next complete message out of the input buffer
+// returns false if a complete message has not been received yet
+// the message is NUL-terminated and stays valid until the next call to readInput() or nextMessage()
+bool messaging::nextMessage(string_view &message)
 {
-	unsigned int message_length = 0;
-	
-	try
+	return stdinReader.next(message);
+}
+
+void messaging::sendMessage(const string &type, const string &content, const Json &requestId)
+{
+	Json json = Json::Parse("{}");
+	json.AddProperty("type", Json(type));
+	json.AddProperty("content", Json(content));
+	sendReply(json, requestId);
+}
+
+// Send a reply to a request, the id of the request is echoed back if it had one
+void messaging::sendReply(Json &msg, const Json &requestId)
+{
+	if(!requestId.IsNull())
 	{
-		//fread is blocking
-		//it blocks until 4 bytes is read
-		int bytes_read = fread(&message_length, sizeof(char), 4, stdin);
+		msg.AddProperty("requestId", requestId);
+	}
+	sendMessage(msg);
+}
 
-		if(bytes_read != 4 || message_length <=0)
-		{
-			PLOG_INFO <<"bytes read: " << bytes_read;
+void messaging::sendMessage(const ggicci::Json &msg, bool mustDeliver)
+{
+	string type = msg.Contains("type")? msg["type"].AsString() : "";
+	string dlHash = msg.Contains("dlHash")? msg["dlHash"].AsString() : "";
 
-			throw grb_exception("bad message length");
-		}
+	//progress that must be delivered is the last one of a download and goes with its completion
+	message_lane lane = LANE_NORMAL;
+	if(type == MSGTYP_ERR || type == MSGTYP_ERR_GUI || type == MSGTYP_YTDL_COMP ||
+			type == MSGTYP_YTDL_FAIL || type == MSGTYP_YTDL_KILL || (type == MSGTYP_YTDLPROG && mustDeliver))
+	{
+		lane = LANE_URGENT;
+	}
+	else if(type == MSGTYP_YTDL_INFO || type == MSGTYP_YTDL_INFO_YTPL || type == MSGTYP_YTDLPROG)
+	{
+		lane = LANE_BULK;
 	}
-	catch(exception &e)
+
+	//progress is the only thing we can afford to lose
+	bool droppable = (type == MSGTYP_YTDLPROG && !mustDeliver);
+
+	//the writer escapes strings itself so the message is serialized straight into the frame
+	string frame;
+	frame.reserve(256);
+	msg.Write(frame, true);
+
+	sendFrame(frame, lane, dlHash, droppable);
+}
+
+// Queue a message for the writer thread, this never blocks on stdout
+// messages that are too long for native messaging are split into chunks
+void messaging::sendMessageRaw(string_view content, message_lane lane, const string &dlHash, bool droppable)
+{
+	//the escaped message is written straight into the buffer that goes into the queue
+	string frame;
+	utils::escapeJSON(content, frame, false);
+
+	sendFrame(frame, lane, dlHash, droppable);
+}
+
+static void sendFrame(string &frame, message_lane lane, const string &dlHash, bool droppable)
+{
+	if(frame.length() > NATIVE_MESSAGE_MAX_LEN)
 	{
-		string msg = "Error reading message length: ";
-		msg.append(e.what());
-		throw fatal_exception(msg.c_str());
+		if(droppable)
+		{
+			return;
+		}
+
+		sendChunked(frame, lane, dlHash);
+		return;
 	}
 
-	try
+	//a frame can be a whole playlist, the start is enough to tell which message it is
+	if(frame.length() > LOG_FRAME_LEN)
+	{
+		PLOG_INFO << "sending " << frame.length() << " bytes: " << frame.substr(0, LOG_FRAME_LEN) << "...";
+	}
+	else
 	{
-		char* message = new char[message_length];
-		int bytes_read = fread(message, sizeof(char), message_length, stdin);
+		PLOG_INFO << "sending: " << frame;
+	}
 
-		string m(message, 0, message_length);
-		delete message;
+	enqueue(frame, lane, dlHash, droppable);
+}
+
+//how much of a message one chunk carries at most, room is left for the fields around the data
+const size_t CHUNK_DATA_MAX = NATIVE_MESSAGE_MAX_LEN - 256;
+
+// Split a message into "chunk" messages that each fit in a native message
+// every chunk carries the JSON-escaped data of a slice of the message, the index of the chunk and
+// an id shared by all chunks of the message, the last chunk also has "last", "count" and "totalLength"
+// the extension concatenates the data of the chunks and handles the result like any other message
+// chunks are queued as soon as they are made so the writer can start sending before we're done
+// once the first chunk is queued the rest are never refused, the extension would be left with half a message
+static void sendChunked(const string &content, message_lane lane, const string &dlHash)
+{
+	unsigned int chunkId = ++lastChunkId;
+	int index = 0;
+	size_t pos = 0;
 
-		if(bytes_read != message_length)
+	PLOG_INFO << "sending message of length " << content.length() << " in chunks with id " << chunkId;
+
+	while(pos < content.length())
+	{
+		string chunk = makeChunk(content, pos, chunkId, index);
+		if(pos == content.length())
 		{
-			throw grb_exception("Read bytes doesn't match message length");
+			chunk += ",\"last\":true,\"count\":" + to_string(index + 1) + ",\"totalLength\":" + to_string(content.length());
 		}
+		chunk += "}";
 
-		return m;
+		enqueue(chunk, lane, dlHash, false, index > 0);
+		index++;
 	}
-	catch(exception &e)
+}
+
+// the chunk of content that starts at pos, without its closing brace so the caller can add the fields of the last one
+// pos is moved past the slice the chunk carries
+static string makeChunk(string_view content, size_t &pos, unsigned int chunkId, int index)
+{
+	string chunk = "{\"type\":\"" MSGTYP_CHUNK "\",\"chunkId\":" + to_string(chunkId) + ",\"index\":" + to_string(index) + ",\"data\":\"";
+	size_t dataStart = chunk.length();
+
+	//control characters are already escaped so escaping at most doubles the size of a slice
+	while(pos < content.length())
 	{
-		string msg = "Error reading raw message: ";
-		msg.append(e.what());
-		throw grb_exception(msg.c_str());
+		size_t room = (CHUNK_DATA_MAX - (chunk.length() - dataStart)) / 2;
+		if(room < 4) break;
+
+		//never cut a multi-byte UTF-8 character in two
+		size_t sliceEnd = min(content.length(), pos + room);
+		while(sliceEnd > pos && sliceEnd < content.length() && (content[sliceEnd] & 0xC0) == 0x80) sliceEnd--;
+
+		utils::escapeJSON(content.substr(pos, sliceEnd - pos), chunk);
+		pos = sliceEnd;
 	}
 
+	chunk += "\"";
+	return chunk;
 }
 
-void messaging::sendMessage(const string &type, const string &content)
+message_stream::message_stream(message_lane lane, const string &dlHash): dlHash(dlHash), lane(lane),
+		chunkId(0), index(0), length(0)
+{
+}
+
+message_stream::~message_stream(void)
 {
-	Json json = Json::Parse("{}");
-	json.AddProperty("type", Json(type));
-	json.AddProperty("content", Json(content));
-	sendMessage(json);
 }
 
-void messaging::sendMessage(const ggicci::Json &msg)
+// Add the next piece of the serialized message
+// once the message can't fit in a native message the chunks that are full are queued
+void message_stream::append(string_view json)
 {
-	sendMessageRaw(msg.ToString());
+	frame.append(json.data(), json.length());
+	length += json.length();
+
+	if(chunkId == 0 && frame.length() <= NATIVE_MESSAGE_MAX_LEN)
+	{
+		return;
+	}
+
+	if(chunkId == 0)
+	{
+		chunkId = ++lastChunkId;
+		PLOG_INFO << "sending message in chunks with id " << chunkId << " while it is built";
+	}
+
+	//with more left than a chunk can carry the chunk fills up before it gets to the end of the frame,
+	//so it never ends in a character that is only partly appended yet
+	size_t pos = 0;
+	while(frame.length() - pos > CHUNK_DATA_MAX)
+	{
+		string chunk = makeChunk(frame, pos, chunkId, index);
+		chunk += "}";
+		enqueue(chunk, lane, dlHash, false, index > 0);
+		index++;
+	}
+	frame.erase(0, pos);
 }
 
-void messaging::sendMessageLimit(const ggicci::Json &msg, int interval)
+// Queue what is left of the message, as a single message if it was never long enough for chunks
+void message_stream::finish()
 {
-	std::time_t t = std::time(nullptr) - lastSentTime;
-	if(t >= interval)
+	if(chunkId == 0)
 	{
-		sendMessage(msg);
+		sendFrame(frame, lane, dlHash, false);
+		return;
 	}
+
+	size_t pos = 0;
+	do
+	{
+		string chunk = makeChunk(frame, pos, chunkId, index);
+		if(pos == frame.length())
+		{
+			chunk += ",\"last\":true,\"count\":" + to_string(index + 1) + ",\"totalLength\":" + to_string(length);
+		}
+		chunk += "}";
+		enqueue(chunk, lane, dlHash, false, index > 0);
+		index++;
+	}
+	while(pos < frame.length());
+
+	PLOG_INFO << "sent message of length " << length << " in " << index << " chunks with id " << chunkId;
+	string().swap(frame);
 }
 
-void messaging::sendMessageRaw(string content)
+// when a download has a new urgent message its queued progress messages are dropped
+// so the extension never receives progress after a completion
+// the messages of a download stay in order, one never passes another of the same download in a slower lane
+// accepted is for the chunks after the first of a message, they are queued even over the memory budget
+static void enqueue(string &content, message_lane lane, const string &dlHash, bool droppable, bool accepted)
 {
-	std::lock_guard<std::mutex> lock(theMutex);
+	std::call_once(writerStarted, [](){
+		std::thread th1(writer_th);
+		th1.detach();
+	});
 
-	lastSentTime = std::time(nullptr);
+	{
+		std::lock_guard<std::mutex> lock(outQueue.mutex);
+
+		if(lane == LANE_URGENT && dlHash.length() > 0)
+		{
+			dropQueued(dlHash);
+		}
 
-	utils::strReplaceAll(content, "\r", "\\r");
-	utils::strReplaceAll(content, "\n", "\\n");
+		if(dlHash.length() > 0)
+		{
+			lane = laneAfter(dlHash, lane);
+		}
+
+		//backpressure: over the memory budget we shed progress and refuse bulk payloads
+		//urgent and normal messages are small and always accepted
+		if(outQueue.queuedBytes + content.length() > OUTBOUND_QUEUE_MAX_BYTES)
+		{
+			dropQueued("");
+
+			if(droppable)
+			{
+				return;
+			}
+
+			if(lane == LANE_BULK && !accepted && outQueue.queuedBytes + content.length() > OUTBOUND_QUEUE_MAX_BYTES)
+			{
+				throw grb_exception("outbound message queue is full");
+			}
+		}
+
+		outbound_frame frame;
+		frame.length = content.length();
+		frame.content.swap(content);
+		frame.dlHash = dlHash;
+		frame.droppable = droppable;
+
+		outQueue.queuedBytes += frame.content.length();
+		outQueue.lanes[lane].push_back(std::move(frame));
+	}
+
+	outQueue.outCond.notify_one();
+}
+
+// Wait until the writer has written everything that is queued
+// used before exiting so the last error message is not lost
+void messaging::flush(int timeoutMs)
+{
+	std::unique_lock<std::mutex> lock(outQueue.mutex);
+	outQueue.flushCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [](){
+		return outQueue.queuedBytes == 0 && !outQueue.writing && outQueue.lanes[LANE_URGENT].empty() &&
+				outQueue.lanes[LANE_NORMAL].empty() && outQueue.lanes[LANE_BULK].empty();
+	});
+}
+
+// the slowest lane from lane onwards that has a queued message of the download
+// the queue mutex must be held
+static message_lane laneAfter(const string &dlHash, message_lane lane)
+{
+	for(int i=LANE_COUNT-1; i>lane; i--)
+	{
+		for(deque<outbound_frame>::iterator it = outQueue.lanes[i].begin(); it != outQueue.lanes[i].end(); ++it)
+		{
+			if(it->dlHash == dlHash)
+			{
+				return (message_lane)i;
+			}
+		}
+	}
+	return lane;
+}
 
-	if(content.length() > NATIVE_MESSAGE_MAX_LEN)
+// drops the queued droppable messages of a download, or of every download if dlHash is empty
+// the queue mutex must be held
+static void dropQueued(const string &dlHash)
+{
+	for(int i=0; i<LANE_COUNT; i++)
 	{
-		throw grb_exception("message is too long");
+		deque<outbound_frame>::iterator it = outQueue.lanes[i].begin();
+		while(it != outQueue.lanes[i].end())
+		{
+			if(it->droppable && (dlHash.length() == 0 || it->dlHash == dlHash))
+			{
+				outQueue.queuedBytes -= it->content.length();
+				it = outQueue.lanes[i].erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
 	}
+}
 
-	PLOG_INFO << "sending: " << content;
+// writes a batch of frames to stdout with as few syscalls as possible
+// returns false if stdout is broken, nothing more can reach the browser then
+static bool writeFrames(vector<outbound_frame> &batch)
+{
+	vector<iovec> iov;
+	iov.reserve(batch.size() * 2);
 
-	try
+	for(size_t i=0; i<batch.size(); i++)
 	{
-		const unsigned int message_length = content.length();
-		fwrite(&message_length, sizeof(char), 4, stdout);
-		fwrite(content.c_str(), sizeof(char), message_length, stdout);
-		fflush(stdout);
+		iovec header = { &batch[i].length, 4 };
+		iovec body = { (void*)batch[i].content.data(), batch[i].content.length() };
+		iov.push_back(header);
+		iov.push_back(body);
 	}
-	catch(exception &e)
+
+	size_t first = 0;
+	while(first < iov.size())
 	{
-		string msg = "Failed to send message: ";
-		msg.append(e.what());
-		throw grb_exception(msg.c_str());
+		int count = min(iov.size() - first, (size_t)IOV_MAX);
+		ssize_t written = writev(STDOUT_FILENO, &iov[first], count);
+
+		if(written == -1)
+		{
+			if(errno == EINTR) continue;
+
+			//the browser isn't reading fast enough, wait until it does
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				pollfd pfd = { STDOUT_FILENO, POLLOUT, 0 };
+				poll(&pfd, 1, -1);
+				continue;
+			}
+
+			PLOG_FATAL << "Failed to send message - errno: " << errno;
+			return false;
+		}
+
+		//skip what was written, a partial write leaves us in the middle of an iovec
+		while(first < iov.size() && written >= (ssize_t)iov[first].iov_len)
+		{
+			written -= iov[first].iov_len;
+			first++;
+		}
+		if(written > 0)
+		{
+			iov[first].iov_base = (char*)iov[first].iov_base + written;
+			iov[first].iov_len -= written;
+		}
 	}
 
+	return true;
+}
+
+// the only thread that writes to stdout
+static void writer_th()
+{
+	const size_t MAX_BATCH_BYTES = 4 * NATIVE_MESSAGE_MAX_LEN;
+	vector<outbound_frame> batch;
+
+	while(true)
+	{
+		try
+		{
+			{
+				std::unique_lock<std::mutex> lock(outQueue.mutex);
+				outQueue.outCond.wait(lock, [](){
+					return !outQueue.lanes[LANE_URGENT].empty() || !outQueue.lanes[LANE_NORMAL].empty() || !outQueue.lanes[LANE_BULK].empty();
+				});
+
+				//take frames in order of priority
+				size_t batchBytes = 0;
+				for(int i=0; i<LANE_COUNT; i++)
+				{
+					while(!outQueue.lanes[i].empty() && (batch.empty() || batchBytes + outQueue.lanes[i].front().content.length() <= MAX_BATCH_BYTES))
+					{
+						batchBytes += outQueue.lanes[i].front().content.length();
+						outQueue.queuedBytes -= outQueue.lanes[i].front().content.length();
+						batch.push_back(std::move(outQueue.lanes[i].front()));
+						outQueue.lanes[i].pop_front();
+					}
+				}
+
+				outQueue.writing = true;
+			}
+
+			for(size_t i=0; i<batch.size(); i++)
+			{
+				recorder::outbound(batch[i].content);
+			}
+
+			//frames can't be dropped without the extension waiting forever for a reply or a completion,
+			//and there is no way left to tell it, so the host stops like it does when stdin breaks
+			if(!writeFrames(batch))
+			{
+				_exit(EXIT_FAILURE);
+			}
+			batch.clear();
+
+			{
+				std::lock_guard<std::mutex> lock(outQueue.mutex);
+				outQueue.writing = false;
+			}
+			outQueue.flushCond.notify_all();
+		}
+		catch(...)
+		{
+			//ain't nothing we can do if we're here
+			batch.clear();
+		}
+	}
 }
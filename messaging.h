@@ -1,17 +1,49 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include "jsonla.h"
 
+//outbound messages are written in order of their lane
+//except that the messages of one download keep the order they were sent in
+enum message_lane
+{
+	LANE_URGENT,	//errors, completions and the last progress of a download
+	LANE_NORMAL,	//replies to requests
+	LANE_BULK		//info payloads and progress
+};
+
+//an outbound message that is serialized piece by piece, for payloads that are too big to build whole first
+//once it is longer than a native message its chunks are queued while the rest of it is still being built
+class message_stream
+{
+	private:
+	std::string frame;			//what hasn't been queued yet
+	std::string dlHash;
+	message_lane lane;
+	unsigned int chunkId;		//0 until the message turns out to need chunks
+	int index;
+	size_t length;
+
+	public:
+	message_stream(message_lane lane, const std::string &dlHash = "");
+	~message_stream(void);
+	void append(std::string_view json);
+	void finish();
+};
+
 class messaging
 {
 public:
 	messaging(void);
 	~messaging(void);
-	static std::string get_message();
-	static void sendMessage(const std::string &type, const std::string &content);
-	static void sendMessageLimit(const ggicci::Json &msg, int interval);
-	static void sendMessage(const ggicci::Json &msg);
-	static void sendMessageRaw(std::string content);
+	static bool readInput();
+	static bool nextMessage(std::string_view &message);
+	static void sendMessage(const std::string &type, const std::string &content, const ggicci::Json &requestId = ggicci::Json());
+	static void sendReply(ggicci::Json &msg, const ggicci::Json &requestId);
+	static void sendMessage(const ggicci::Json &msg, bool mustDeliver = false);
+	static void sendMessageRaw(std::string_view content, message_lane lane = LANE_NORMAL,
+		const std::string &dlHash = "", bool droppable = false);
+	static void flush(int timeoutMs = 1000);
 };
 
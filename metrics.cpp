@@ -0,0 +1,118 @@
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <plog/Log.h>
+#include "metrics.h"
+
+using namespace std;
+using namespace ggicci;
+
+//rotated the way plog rotates log.txt, metrics.jsonl is moved to metrics.1.jsonl once it gets bigger than this
+const long METRICS_MAX_SIZE = 1000 * 1000;
+
+std::mutex metricsMutex;
+FILE *metricsFile = NULL;
+string metricsPath;
+long metricsSize = 0;
+
+metrics::metrics(void)
+{
+}
+
+metrics::~metrics(void)
+{
+}
+
+void metrics::init()
+{
+	const char *path = getenv("GRABBY_METRICS");
+	if(path == NULL || path[0] == '\0')
+	{
+		path = "metrics.jsonl";
+	}
+
+	metricsPath = path;
+	metricsFile = fopen(path, "ab");
+	if(metricsFile == NULL)
+	{
+		PLOG_ERROR << "could not open metrics file " << path;
+		return;
+	}
+
+	fseek(metricsFile, 0, SEEK_END);
+	metricsSize = ftell(metricsFile);
+}
+
+//the older file gets .1 before the extension, the one it replaces is dropped
+static void rotate()
+{
+	size_t dot = metricsPath.find_last_of('.');
+	size_t slash = metricsPath.find_last_of('/');
+	if(dot == string::npos || (slash != string::npos && dot < slash))
+	{
+		dot = metricsPath.length();
+	}
+	string older = metricsPath.substr(0, dot) + ".1" + metricsPath.substr(dot);
+
+	fclose(metricsFile);
+	rename(metricsPath.c_str(), older.c_str());
+	metricsFile = fopen(metricsPath.c_str(), "wb");
+	metricsSize = 0;
+	if(metricsFile == NULL)
+	{
+		PLOG_ERROR << "could not open metrics file " << metricsPath;
+	}
+}
+
+Json metrics::usageJson(const process_usage &usage)
+{
+	Json json = Json::Parse("{}");
+	json.AddProperty("wall_ms", Json((int64_t)usage.wallMs));
+	json.AddProperty("cpu_user_ms", Json((int64_t)usage.cpuUserMs));
+	json.AddProperty("cpu_sys_ms", Json((int64_t)usage.cpuSysMs));
+	json.AddProperty("max_rss_kb", Json((int64_t)usage.maxRssKB));
+	json.AddProperty("read_bytes", Json((int64_t)usage.readBytes));
+	json.AddProperty("write_bytes", Json((int64_t)usage.writeBytes));
+	return json;
+}
+
+//thread-safe
+void metrics::record(const string &job, const string &dlHash, const string &url, const vector<string> &args,
+		const process_result &res)
+{
+	if(metricsFile == NULL) return;
+
+	string format;
+	for(size_t i=0; i+1<args.size(); i++)
+	{
+		if(args[i] == "-f") format = args[i+1];
+	}
+
+	long long t = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+	Json json = Json::Parse("{}");
+	json.AddProperty("t", Json((int64_t)t));
+	json.AddProperty("job", Json(job));
+	json.AddProperty("dlHash", Json(dlHash));
+	json.AddProperty("url", Json(url));
+	json.AddProperty("format", Json(format));
+	json.AddProperty("exitCode", Json((int64_t)res.exitCode));
+	json.AddProperty("usage", usageJson(res.usage));
+
+	string line;
+	json.Write(line, true);
+	line += '\n';
+
+	std::lock_guard<std::mutex> lock(metricsMutex);
+	if(metricsFile == NULL) return;
+	if(metricsSize > 0 && metricsSize + (long)line.length() > METRICS_MAX_SIZE)
+	{
+		rotate();
+		if(metricsFile == NULL) return;
+	}
+	fwrite(line.data(), sizeof(char), line.length(), metricsFile);
+	fflush(metricsFile);
+	metricsSize += line.length();
+}
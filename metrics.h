@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "types.h"
+#include "jsonla.h"
+
+//keeps what every ytdl job has cost so expensive sites and formats can be found
+//each line of metrics.jsonl, or of the file GRABBY_METRICS points to, is one finished job:
+//{"t":<unix ms>,"job":<message type>,"dlHash":..,"url":..,"format":<the -f of ytdl>,"exitCode":..,"usage":{..}}
+//the file is kept under 1 MB, the lines before that are in metrics.1.jsonl
+class metrics
+{
+
+public:
+	metrics(void);
+	~metrics(void);
+	static void init();
+	static ggicci::Json usageJson(const process_usage &usage);
+	static void record(const std::string &job, const std::string &dlHash, const std::string &url,
+		const std::vector<std::string> &args, const process_result &res);
+};
@@ -1,11 +1,8 @@
 #include "output_callback.h"
-#include "messaging.h"
+#include "progress.h"
 #include "utils.h"
-#include "defines.h"
-#include "jsonla.h"
 #include <string>
 
-using namespace ggicci;
 using namespace std;
 
 output_callback::output_callback(const string &hash) : dlHash(hash)
@@ -16,45 +13,38 @@ output_callback::~output_callback(void)
 {
 }
 
-void output_callback::call(const string &output)
+//line is a single line of output with its newline, the last line of the output may not have one
+//progress lines look like " 42.0%|1.00MiB/s|NA"
+//lines that aren't progress only cost the two finds
+void output_callback::call(string_view line)
 {
-	//get last line of output, cause output can be multiple lines
-	vector<string> lines = utils::strSplit(output, '\n');
-	string line = lines.back();
-
-	if(line.find('|') == string::npos || line.find('%') == string::npos)
+	if(line.find('|') == string_view::npos || line.find('%') == string_view::npos)
 	{
 		return;
 	}
 
-	vector<string> parts = utils::strSplit(line, '|');
+	//the first 3 non-empty parts between the |s
+	string_view parts[3];
+	int count = 0;
+	size_t start = 0;
+	while(start < line.size() && count < 3)
+	{
+		size_t end = line.find('|', start);
+		if(end == string_view::npos) end = line.size();
+		if(end > start) parts[count++] = line.substr(start, end - start);
+		start = end + 1;
+	}
 
-	if(parts.size() == 0)
+	if(count < 3)
 	{
 		return;
 	}
 
-	string percent_str = utils::trim(parts[0]);
-	string speed_str = utils::trim(parts[1]);
-	string plIndex_str = utils::trim(parts[2]);
+	string_view percent_str = utils::trimView(parts[0]);
+	string_view speed_str = utils::trimView(parts[1]);
+	string_view plIndex_str = utils::trimView(parts[2]);
 
 	percent_str = percent_str.substr(0, percent_str.find_last_of('%'));
-	int percent = atoi(percent_str.c_str());
-
-	Json msg = Json::Parse("{}");
-	msg.AddProperty("type", Json(MSGTYP_YTDLPROG));
-	msg.AddProperty("dlHash", Json(dlHash));
-	msg.AddProperty("percent_str", Json(percent_str));
-	msg.AddProperty("speed_str", Json(speed_str));
-	msg.AddProperty("playlist_index", Json(plIndex_str));
 
-	//always send the 100% message
-	if(percent == 100)
-	{
-		messaging::sendMessage(msg);
-	}
-	else
-	{
-		messaging::sendMessageLimit(msg, 1);
-	}
+	progress::update(dlHash, percent_str, speed_str, plIndex_str);
 }
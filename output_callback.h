@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 class output_callback
 {
@@ -10,6 +11,6 @@ class output_callback
 	public:
 	output_callback(const std::string &hash);
 	~output_callback(void);
-	void call(const std::string &output);
+	void call(std::string_view line);
 };
 
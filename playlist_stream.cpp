@@ -0,0 +1,363 @@
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <string.h>
+#include <zlib.h>
+#include "playlist_stream.h"
+#include "messaging.h"
+#include "task_pool.h"
+#include "event_loop.h"
+#include "utils.h"
+#include "exceptions.h"
+#include "defines.h"
+
+using namespace std;
+using namespace ggicci;
+
+//a part is cut once it has this much JSON, big enough that starting every part with an empty window costs little
+const size_t PLAYLIST_PART_BYTES = 512 * 1024;
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+struct playlist_part
+{
+	string json;			//the lines of the part, each after the [ or , that comes before it, freed once deflated
+	vector<size_t> ends;	//where each line ends in json
+	bool final = false;
+	string deflated;
+	uLong crc = 0;			//crc32 of the JSON of the part
+	size_t length = 0;		//length of the JSON of the part
+	string error;
+};
+
+struct playlist_job
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	vector<unique_ptr<playlist_part>> parts;	//the parts that have been cut, in order
+	size_t next = 0;							//the first part nobody has taken yet
+	size_t done = 0;
+	std::function<void()> resume;				//set while the output of ytdl is paused, see cut()
+};
+
+static void deflateInto(z_stream &zs, playlist_part &part, const char *data, size_t size, int flush)
+{
+	//crc32 of a null buffer would be the initial crc
+	if(size > 0)
+	{
+		part.crc = crc32(part.crc, (const Bytef *)data, size);
+		part.length += size;
+	}
+
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = size;
+
+	//with Z_FINISH deflate has to be called until the stream ends, otherwise until it stops filling zout
+	unsigned char zout[16 * 1024];
+	int ret;
+	do
+	{
+		zs.next_out = zout;
+		zs.avail_out = sizeof(zout);
+		ret = deflate(&zs, flush);
+		if(ret == Z_STREAM_ERROR)
+		{
+			throw grb_exception("deflate failed");
+		}
+		part.deflated.append((const char *)zout, sizeof(zout) - zs.avail_out);
+	}
+	while(flush == Z_FINISH? ret != Z_STREAM_END : zs.avail_out == 0);
+}
+
+//checks that every line of the part is a single JSON value and deflates the part of the array they make up
+//the parser only keeps track of the nesting, nothing of the lines is copied or allocated
+static void deflatePart(playlist_part &part)
+{
+	entry_counter counter;
+	JsonPushParser checker(counter);
+
+	part.crc = crc32(0, Z_NULL, 0);
+	part.length = 0;
+
+	//raw deflate, the gzip header and trailer go around the parts when they are joined
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if(deflateInit2(&zs, 9, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		throw grb_exception("deflate init failed");
+	}
+
+	try
+	{
+		size_t start = 1;
+		for(size_t i=0; i<part.ends.size(); i++)
+		{
+			counter.count = 0;
+			checker.Reset();
+			checker.Feed(string_view(part.json).substr(start, part.ends[i] - start));
+			checker.Finish();
+			if(counter.count != 1)
+			{
+				throw grb_exception("playlist entry is not a single JSON value");
+			}
+			start = part.ends[i] + 1;
+		}
+
+		deflateInto(zs, part, part.json.data(), part.json.size(), Z_NO_FLUSH);
+
+		//a sync flush ends the part on a byte boundary without marking its last block as the final one
+		if(part.final)
+		{
+			deflateInto(zs, part, "]", 1, Z_FINISH);
+		}
+		else
+		{
+			deflateInto(zs, part, NULL, 0, Z_SYNC_FLUSH);
+		}
+	}
+	catch(...)
+	{
+		deflateEnd(&zs);
+		throw;
+	}
+
+	deflateEnd(&zs);
+
+	string().swap(part.json);
+	vector<size_t>().swap(part.ends);
+}
+
+//takes the first part nobody has taken yet and deflates it, returns false if there was none
+static bool deflateNext(playlist_job &job)
+{
+	playlist_part *taken;
+	{
+		std::lock_guard<std::mutex> lock(job.mutex);
+		if(job.next >= job.parts.size())
+		{
+			return false;
+		}
+		taken = job.parts[job.next++].get();
+	}
+
+	playlist_part &part = *taken;
+	try
+	{
+		deflatePart(part);
+	}
+	catch(exception &e)
+	{
+		part.error = e.what();
+	}
+	catch(...)
+	{
+		part.error = "unknown error";
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(job.mutex);
+		job.done++;
+
+		if(job.resume && job.parts.size() - job.done <= (size_t)task_pool::size())
+		{
+			eventloop::post(std::move(job.resume));
+			job.resume = nullptr;
+		}
+	}
+	job.cond.notify_all();
+	return true;
+}
+
+//takes parts until there are none left, run by a helper on the task pool for every part that is cut
+//and by the thread that finishes the playlist
+static void deflateParts(shared_ptr<playlist_job> job)
+{
+	while(deflateNext(*job)){}
+}
+
+playlist_stream::playlist_stream(const string &dlHash): dlHash(dlHash), job(make_shared<playlist_job>()),
+		current(new playlist_part()), entries(0), carried(0)
+{
+	//everything before the info is known up front, the info itself is appended as it is encoded
+	frame += "{\"type\":\"" MSGTYP_YTDL_INFO_YTPL "\",\"dlHash\":";
+	Json(dlHash).Write(frame, true);
+	frame += ",\"info\":\"";
+}
+
+playlist_stream::~playlist_stream(void)
+{
+}
+
+//the line is one entry of the playlist without its newline
+//it is only checked once its part is deflated, finish() throws if it isn't a single JSON value
+void playlist_stream::add(string_view line)
+{
+	current->json += (entries == 0)? '[' : ',';
+	current->json.append(line);
+	current->ends.push_back(current->json.size());
+	entries++;
+
+	if(current->json.size() >= PLAYLIST_PART_BYTES)
+	{
+		cut();
+	}
+}
+
+//hands the current part to a helper on the task pool and starts the next one
+//when ytdl prints faster than the pool deflates, the output of ytdl isn't read until the pool has caught up,
+//so ytdl waits and the lines don't pile up in memory while the event loop goes on with everything else
+void playlist_stream::cut()
+{
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->parts.push_back(std::move(current));
+
+		//under the lock so the part that catches up can't miss the resume
+		if(!job->resume && job->parts.size() - job->done > (size_t)task_pool::size())
+		{
+			job->resume = utils::pauseOutput();
+		}
+	}
+	current.reset(new playlist_part());
+
+	shared_ptr<playlist_job> shared = job;
+	task_pool::run("", [shared](){ deflateParts(shared); });
+}
+
+//deflates what is left once the last line has been added, throws if one of the lines isn't a single JSON value
+//this thread works on the parts too, so the playlist gets done even when every worker is busy
+//and waiting below only ever waits for parts that are being worked on
+void playlist_stream::finish()
+{
+	if(entries == 0)
+	{
+		current->json += '[';
+	}
+	current->final = true;
+
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->parts.push_back(std::move(current));
+	}
+	deflateParts(job);
+
+	{
+		std::unique_lock<std::mutex> lock(job->mutex);
+		playlist_job *j = job.get();
+		job->cond.wait(lock, [j](){ return j->done == j->parts.size(); });
+	}
+
+	for(size_t i=0; i<job->parts.size(); i++)
+	{
+		if(job->parts[i]->error.length() > 0)
+		{
+			throw grb_exception(job->parts[i]->error.c_str());
+		}
+	}
+}
+
+//finish() has to have been called
+//the frame is handed to the message stream part by part, so the chunks of a long playlist go out
+//while the rest is still being encoded and the whole frame is never held
+void playlist_stream::send(const Json &requestId)
+{
+	message_stream out(LANE_BULK, dlHash);
+
+	//gzip header: magic, deflate, no flags, no time, best compression, unix
+	static const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 2, 3};
+	encode(header, sizeof(header));
+
+	//the parts joined in order are one deflate stream, their crcs are combined into the one of the whole
+	uLong crc = job->parts[0]->crc;
+	size_t length = 0;
+	for(size_t i=0; i<job->parts.size(); i++)
+	{
+		playlist_part &part = *job->parts[i];
+		encode((const unsigned char *)part.deflated.data(), part.deflated.size());
+		if(i > 0)
+		{
+			crc = crc32_combine(crc, part.crc, part.length);
+		}
+		length += part.length;
+		string().swap(part.deflated);
+
+		out.append(frame);
+		frame.clear();
+	}
+
+	unsigned char trailer[8];
+	for(int i=0; i<4; i++)
+	{
+		trailer[i] = (crc >> (8 * i)) & 0xff;
+		trailer[4 + i] = (length >> (8 * i)) & 0xff;
+	}
+	encode(trailer, sizeof(trailer));
+
+	//the last base64 group is padded
+	if(carried > 0)
+	{
+		unsigned int bits = carry[0] << 16 | (carried > 1? carry[1] << 8 : 0);
+		frame += base64Chars[bits >> 18 & 0x3f];
+		frame += base64Chars[bits >> 12 & 0x3f];
+		frame += carried > 1? base64Chars[bits >> 6 & 0x3f] : '=';
+		frame += '=';
+		carried = 0;
+	}
+	frame += '"';
+
+	if(!requestId.IsNull())
+	{
+		frame += ",\"requestId\":";
+		requestId.Write(frame, true);
+	}
+	frame += '}';
+
+	out.append(frame);
+	string().swap(frame);
+	out.finish();
+}
+
+//appends the base64 of the compressed bytes to the frame
+//bytes that don't make a whole group of 3 are carried over to the next call
+void playlist_stream::encode(const unsigned char *data, size_t size)
+{
+	size_t i = 0;
+	while(carried > 0 && carried < 3 && i < size)
+	{
+		carry[carried++] = data[i++];
+	}
+
+	size_t groups = (size - i) / 3 + (carried == 3? 1 : 0);
+	size_t at = frame.size();
+	frame.resize(at + groups * 4);
+	char *out = &frame[at];
+
+	if(carried == 3)
+	{
+		unsigned int bits = carry[0] << 16 | carry[1] << 8 | carry[2];
+		out[0] = base64Chars[bits >> 18 & 0x3f];
+		out[1] = base64Chars[bits >> 12 & 0x3f];
+		out[2] = base64Chars[bits >> 6 & 0x3f];
+		out[3] = base64Chars[bits & 0x3f];
+		out += 4;
+		carried = 0;
+	}
+
+	for(; i + 3 <= size; i += 3)
+	{
+		unsigned int bits = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+		out[0] = base64Chars[bits >> 18 & 0x3f];
+		out[1] = base64Chars[bits >> 12 & 0x3f];
+		out[2] = base64Chars[bits >> 6 & 0x3f];
+		out[3] = base64Chars[bits & 0x3f];
+		out += 4;
+	}
+
+	while(i < size)
+	{
+		carry[carried++] = data[i++];
+	}
+}
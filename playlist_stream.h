@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include "jsonla.h"
+
+//counts the values on a line, a playlist entry has to be exactly one
+struct entry_counter: public ggicci::JsonHandler
+{
+	int count = 0;
+	void EndDocument() { count++; }
+};
+
+struct playlist_part;
+struct playlist_job;
+
+//builds the ytdl_info_ytpl message of a playlist without ever holding the playlist as Json or as text
+//ytdl prints one line of JSON for each entry, every line is checked and then written into a JSON array
+//that goes through gzip and base64 straight into the frame of the message, which is queued in chunks as it grows
+//so the memory used follows the compressed size of the playlist, not its size
+//
+//the lines are added as ytdl prints them and cut into parts that are checked and deflated on the task pool
+//while ytdl is still running, so the text of the playlist is never held all at once either
+//every part is a run of whole deflate blocks so the parts joined in order make one gzip stream
+class playlist_stream
+{
+	private:
+	std::string dlHash;
+	std::string frame;
+	std::shared_ptr<playlist_job> job;
+	std::unique_ptr<playlist_part> current;		//the part the lines are added to until it is big enough
+	size_t entries;
+	unsigned char carry[3];		//compressed bytes waiting for a whole base64 group
+	int carried;
+
+	void cut();
+	void encode(const unsigned char *data, size_t size);
+
+	public:
+	playlist_stream(const std::string &dlHash);
+	~playlist_stream(void);
+	void add(std::string_view line);
+	void finish();
+	void send(const ggicci::Json &requestId);
+};
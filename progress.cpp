@@ -0,0 +1,107 @@
+#include <map>
+#include <string>
+#include "progress.h"
+#include "messaging.h"
+#include "event_loop.h"
+#include "defines.h"
+#include "jsonla.h"
+
+using namespace std;
+using namespace ggicci;
+
+struct progress_slot
+{
+	string percent_str;
+	string speed_str;
+	string plIndex_str;
+	bool pending;
+};
+
+map<string, progress_slot> progressSlots;
+int progressTimer = 0;
+
+//the 100% and final progress messages are never dropped from the outbound queue
+static void sendProgress(const string &dlHash, progress_slot &slot, bool mustDeliver = false)
+{
+	Json msg = Json::Parse("{}");
+	msg.AddProperty("type", Json(MSGTYP_YTDLPROG));
+	msg.AddProperty("dlHash", Json(dlHash));
+	msg.AddProperty("percent_str", Json(slot.percent_str));
+	msg.AddProperty("speed_str", Json(slot.speed_str));
+	msg.AddProperty("playlist_index", Json(slot.plIndex_str));
+	messaging::sendMessage(msg, mustDeliver);
+
+	slot.pending = false;
+}
+
+progress::progress(void)
+{
+}
+
+progress::~progress(void)
+{
+}
+
+//the strings are assigned into the slot, whose buffers are reused from one update to the next
+void progress::update(const string &dlHash, string_view percent_str, string_view speed_str, string_view plIndex_str)
+{
+	bool first = (progressSlots.count(dlHash) == 0);
+
+	progress_slot &slot = progressSlots[dlHash];
+	slot.percent_str.assign(percent_str);
+	slot.speed_str.assign(speed_str);
+	slot.plIndex_str.assign(plIndex_str);
+	slot.pending = true;
+
+	//always send the 100% message, and the first one so the download shows up right away
+	if(atoi(slot.percent_str.c_str()) == 100)
+	{
+		sendProgress(dlHash, slot, true);
+	}
+	else if(first)
+	{
+		sendProgress(dlHash, slot);
+	}
+
+	//the timer only runs while there are downloads
+	if(progressTimer == 0)
+	{
+		progressTimer = eventloop::addTimer(PROGRESS_INTERVAL_MS, true, progress::flush);
+	}
+}
+
+//sends the last progress of a download if it hasn't been sent yet and forgets the download
+void progress::finish(const string &dlHash)
+{
+	map<string, progress_slot>::iterator it = progressSlots.find(dlHash);
+	if(it == progressSlots.end())
+	{
+		return;
+	}
+
+	progress_slot slot = it->second;
+	progressSlots.erase(it);
+
+	if(slot.pending)
+	{
+		sendProgress(dlHash, slot, true);
+	}
+}
+
+void progress::flush()
+{
+	map<string, progress_slot>::iterator it = progressSlots.begin();
+	for(; it != progressSlots.end(); ++it)
+	{
+		if(it->second.pending)
+		{
+			sendProgress(it->first, it->second);
+		}
+	}
+
+	if(progressSlots.size() == 0 && progressTimer != 0)
+	{
+		eventloop::cancelTimer(progressTimer);
+		progressTimer = 0;
+	}
+}
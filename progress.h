@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+//keeps the latest progress of every download and sends it on a timer
+//so the number of progress messages depends on the number of downloads, not on how much ytdl prints
+//only used from the event loop thread
+class progress
+{
+
+public:
+	progress(void);
+	~progress(void);
+	static void update(const std::string &dlHash, std::string_view percent_str,
+		std::string_view speed_str, std::string_view plIndex_str);
+	static void finish(const std::string &dlHash);
+	static void flush();
+};
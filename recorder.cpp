@@ -0,0 +1,70 @@
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <plog/Log.h>
+#include "recorder.h"
+
+using namespace std;
+
+std::mutex recMutex;
+FILE *recFile = NULL;
+bool recordOut = false;
+chrono::steady_clock::time_point recStart;
+
+static void record(const char *dir, string_view frame)
+{
+	long long t = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - recStart).count();
+
+	string line = "{\"t\":" + to_string(t) + ",\"dir\":\"" + dir + "\",\"frame\":";
+	line.append(frame.data(), frame.length());
+	line += "}\n";
+
+	//flushed every time so the capture survives a crash
+	std::lock_guard<std::mutex> lock(recMutex);
+	fwrite(line.data(), sizeof(char), line.length(), recFile);
+	fflush(recFile);
+}
+
+recorder::recorder(void)
+{
+}
+
+recorder::~recorder(void)
+{
+}
+
+void recorder::init()
+{
+	const char *path = getenv("GRABBY_RECORD");
+	if(path == NULL || path[0] == '\0')
+	{
+		return;
+	}
+
+	recFile = fopen(path, "ab");
+	if(recFile == NULL)
+	{
+		PLOG_ERROR << "could not open capture file " << path;
+		return;
+	}
+
+	const char *out = getenv("GRABBY_RECORD_OUT");
+	recordOut = (out != NULL && string(out) == "1");
+	recStart = chrono::steady_clock::now();
+
+	PLOG_INFO << "recording session to " << path;
+}
+
+void recorder::inbound(string_view frame)
+{
+	if(recFile == NULL) return;
+	record("in", frame);
+}
+
+void recorder::outbound(string_view frame)
+{
+	if(recFile == NULL || !recordOut) return;
+	record("out", frame);
+}
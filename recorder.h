@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string_view>
+
+//records native messaging sessions so they can be replayed with grabby_replay, see tools/replay.cpp
+//set GRABBY_RECORD to the path of the capture file to record inbound messages
+//and also set GRABBY_RECORD_OUT=1 to record outbound messages
+//each line of the capture is {"t":<ms since start>,"dir":"in"|"out","frame":<the message>}
+class recorder
+{
+
+public:
+	recorder(void);
+	~recorder(void);
+	static void init();
+	static void inbound(std::string_view frame);
+	static void outbound(std::string_view frame);
+};
@@ -0,0 +1,181 @@
+#include <mutex>
+#include <vector>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <plog/Log.h>
+#include "spawner.h"
+#include "event_loop.h"
+#include "exceptions.h"
+
+using namespace std;
+
+//how often children that nobody waits for are checked for having exited
+const int REAP_INTERVAL_MS = 1000;
+
+std::mutex reapMutex;
+vector<pid_t> detachedChildren;
+int reapTimerId = 0;
+
+
+spawner::spawner(void)
+{
+}
+
+spawner::~spawner(void)
+{
+}
+
+static void addStdio(posix_spawn_file_actions_t *actions, spawn_stdio stdio, int fd, int pipeEnd)
+{
+	if(stdio == STDIO_PIPE)
+	{
+		posix_spawn_file_actions_adddup2(actions, pipeEnd, fd);
+	}
+	else if(stdio == STDIO_NULL)
+	{
+		posix_spawn_file_actions_addopen(actions, fd, "/dev/null", fd == STDIN_FILENO? O_RDONLY : O_WRONLY, 0);
+	}
+}
+
+//throws if the process could not be started, including when the executable can't be found
+spawned_child spawner::spawn(const vector<const char*> &args, const spawn_options &options)
+{
+	const int READ_END = 0;
+	const int WRITE_END = 1;
+
+	//both ends are CLOEXEC, the child only gets the ends that are duplicated onto its standard fds
+	int inPipe[2] = {-1, -1};
+	int outPipe[2] = {-1, -1};
+	if((options.in == STDIO_PIPE && pipe2(inPipe, O_CLOEXEC) != 0) ||
+		(options.out == STDIO_PIPE && pipe2(outPipe, O_CLOEXEC) != 0))
+	{
+		string msg = "could not create pipes - errno: " + to_string(errno);
+		if(inPipe[READ_END] != -1)
+		{
+			close(inPipe[READ_END]);
+			close(inPipe[WRITE_END]);
+		}
+		throw grb_exception(msg.c_str());
+	}
+
+	//a bigger pipe lets the child write more before it has to wait for the host to read
+	//the system may give less than asked for or refuse, the default size still works
+	if(options.out == STDIO_PIPE && options.pipeSize > 0)
+	{
+		fcntl(outPipe[READ_END], F_SETPIPE_SZ, options.pipeSize);
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	addStdio(&actions, options.in, STDIN_FILENO, inPipe[READ_END]);
+	addStdio(&actions, options.out, STDOUT_FILENO, outPipe[WRITE_END]);
+	addStdio(&actions, options.err, STDERR_FILENO, -1);
+
+	//fds opened without CLOEXEC, by plog or a library, would otherwise stay open in the child
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+	if(options.closeFds)
+	{
+		posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+	}
+#endif
+
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	short flags = 0;
+
+	//the mask is inherited from the thread that spawns and ignored signals stay ignored across exec
+	if(options.resetSignals)
+	{
+		sigset_t signals;
+		sigemptyset(&signals);
+		posix_spawnattr_setsigmask(&attr, &signals);
+		sigfillset(&signals);
+		posix_spawnattr_setsigdefault(&attr, &signals);
+		flags |= POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+	}
+	//the group gets the pid of the child as its id
+	if(options.newGroup)
+	{
+		posix_spawnattr_setpgroup(&attr, 0);
+		flags |= POSIX_SPAWN_SETPGROUP;
+	}
+	posix_spawnattr_setflags(&attr, flags);
+
+	pid_t pid;
+	int err = posix_spawnp(&pid, args[0], &actions, &attr, const_cast<char* const*>(args.data()), environ);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	//the ends the child uses are closed in the host whether it started or not
+	if(options.in == STDIO_PIPE) close(inPipe[READ_END]);
+	if(options.out == STDIO_PIPE) close(outPipe[WRITE_END]);
+
+	if(err != 0)
+	{
+		if(options.in == STDIO_PIPE) close(inPipe[WRITE_END]);
+		if(options.out == STDIO_PIPE) close(outPipe[READ_END]);
+		string msg = string("could not start ") + args[0] + " - errno: " + to_string(err);
+		PLOG_ERROR << msg;
+		throw grb_exception(msg.c_str());
+	}
+
+	spawned_child child;
+	child.pid = pid;
+	child.in = inPipe[WRITE_END];
+	child.out = outPipe[READ_END];
+	child.pidfd = -1;
+
+	//the child can't have been reaped yet so the pid can't have been reused
+#ifdef SYS_pidfd_open
+	if(options.pidfd)
+	{
+		child.pidfd = syscall(SYS_pidfd_open, pid, 0);
+	}
+#endif
+
+	return child;
+}
+
+static void reapTick()
+{
+	std::lock_guard<std::mutex> lock(reapMutex);
+
+	vector<pid_t>::iterator it = detachedChildren.begin();
+	while(it != detachedChildren.end())
+	{
+		pid_t r = waitpid(*it, NULL, WNOHANG);
+		if(r == *it || (r == -1 && errno == ECHILD))
+		{
+			it = detachedChildren.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	if(detachedChildren.empty())
+	{
+		eventloop::cancelTimer(reapTimerId);
+		reapTimerId = 0;
+	}
+}
+
+//for children that are started and forgotten, they are reaped on the event loop once they exit
+//thread-safe
+void spawner::reapDetached(pid_t pid)
+{
+	std::lock_guard<std::mutex> lock(reapMutex);
+	detachedChildren.push_back(pid);
+	if(reapTimerId == 0)
+	{
+		reapTimerId = eventloop::addTimer(REAP_INTERVAL_MS, true, reapTick);
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <sys/types.h>
+
+//what one of the standard fds of a child is connected to
+enum spawn_stdio
+{
+	STDIO_INHERIT,		//the same fd of the host
+	STDIO_PIPE,			//a pipe, the other end is given to the caller
+	STDIO_NULL			///dev/null
+};
+
+//how a child is set up between starting and exec
+struct spawn_options
+{
+	spawn_stdio in = STDIO_PIPE;
+	spawn_stdio out = STDIO_PIPE;
+	spawn_stdio err = STDIO_INHERIT;
+	bool closeFds = true;		//close every fd above stderr, not only the ones with CLOEXEC
+	bool resetSignals = true;	//unblock every signal and put back the default handlers
+	int pipeSize = 0;			//capacity asked for the stdout pipe, 0 keeps the default of the system
+	bool newGroup = false;		//start a process group of its own so it can be signalled with its children
+	bool pidfd = false;			//open a pidfd that becomes readable when the child exits
+};
+
+struct spawned_child
+{
+	pid_t pid;
+	int in;		//write end of the stdin pipe, -1 if stdin isn't a pipe
+	int out;	//read end of the stdout pipe, -1 if stdout isn't a pipe
+	int pidfd;	//-1 if it wasn't asked for or the kernel doesn't have pidfds
+};
+
+//starts processes with posix_spawn, which doesn't copy the page tables of the host the way fork does
+//the options are turned into spawn file actions and attributes instead of code running in the child
+class spawner
+{
+
+public:
+	spawner(void);
+	~spawner(void);
+	static spawned_child spawn(const std::vector<const char*> &args, const spawn_options &options = spawn_options());
+	static void reapDetached(pid_t pid);
+};
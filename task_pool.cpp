@@ -0,0 +1,123 @@
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <map>
+#include <plog/Log.h>
+#include "task_pool.h"
+
+using namespace std;
+
+struct keyed_task
+{
+	string key;
+	pool_task task;
+};
+
+struct pool_state
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<keyed_task> ready;
+	//tasks waiting for an earlier task with the same key, a key is in here while one of its tasks is queued or running
+	std::map<std::string, std::deque<pool_task>> waiting;
+};
+
+//never destroyed because the detached workers are still waiting on it while the process exits
+pool_state &poolState = *new pool_state();
+std::once_flag poolStarted;
+
+static void worker_th()
+{
+	while(true)
+	{
+		keyed_task kt;
+
+		{
+			std::unique_lock<std::mutex> lock(poolState.mutex);
+			poolState.cond.wait(lock, [](){ return !poolState.ready.empty(); });
+			kt = std::move(poolState.ready.front());
+			poolState.ready.pop_front();
+		}
+
+		try
+		{
+			kt.task();
+		}
+		catch(...)
+		{
+			PLOG_ERROR << "a pooled task did not consume its exception";
+		}
+
+		if(kt.key.length() == 0)
+		{
+			continue;
+		}
+
+		//let the next task with the same key run
+		{
+			std::lock_guard<std::mutex> lock(poolState.mutex);
+			map<string, deque<pool_task>>::iterator it = poolState.waiting.find(kt.key);
+			if(it->second.empty())
+			{
+				poolState.waiting.erase(it);
+				continue;
+			}
+
+			keyed_task next;
+			next.key = kt.key;
+			next.task = std::move(it->second.front());
+			it->second.pop_front();
+			poolState.ready.push_back(std::move(next));
+		}
+		poolState.cond.notify_one();
+	}
+}
+
+task_pool::task_pool(void)
+{
+}
+
+task_pool::~task_pool(void)
+{
+}
+
+//the number of worker threads
+int task_pool::size()
+{
+	return max(2u, thread::hardware_concurrency());
+}
+
+void task_pool::run(const string &key, pool_task task)
+{
+	std::call_once(poolStarted, [](){
+		int count = size();
+		for(int i=0; i<count; i++)
+		{
+			std::thread th1(worker_th);
+			th1.detach();
+		}
+	});
+
+	{
+		std::lock_guard<std::mutex> lock(poolState.mutex);
+
+		if(key.length() > 0)
+		{
+			map<string, deque<pool_task>>::iterator it = poolState.waiting.find(key);
+			if(it != poolState.waiting.end())
+			{
+				it->second.push_back(task);
+				return;
+			}
+			poolState.waiting[key];
+		}
+
+		keyed_task kt;
+		kt.key = key;
+		kt.task = task;
+		poolState.ready.push_back(std::move(kt));
+	}
+
+	poolState.cond.notify_one();
+}
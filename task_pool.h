@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <functional>
+
+typedef std::function<void()> pool_task;
+
+//a fixed set of worker threads for work that shouldn't hold up the event loop
+//tasks with the same non-empty key run one after another in the order they were added
+//tasks with different keys, or no key, run concurrently
+//tasks must consume their own exceptions
+class task_pool
+{
+
+public:
+	task_pool(void);
+	~task_pool(void);
+	static void run(const std::string &key, pool_task task);
+	static int size();
+};
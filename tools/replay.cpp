@@ -0,0 +1,386 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "spawner.h"
+
+//replays a session captured by the recorder against a new instance of the host
+//usage: grabby_replay <host> <capture.jsonl> [--speed <factor>] [--wait <seconds>] [--entries <n>] [--delay <ms>]
+//a speed of 0 sends the messages as fast as possible, --entries and --delay configure the stub
+//
+//this is a test tool with a main of its own, it isn't part of the host build
+//make -C tools builds it with spawner.cpp, event_loop.cpp and exceptions.cpp of the host
+//yt-dlp is replaced by a stub (this same executable started as yt-dlp-stub) and the save dialogs are skipped,
+//the host only lets them be replaced when it is built with GRABBY_TESTING defined, make -C tools
+//builds that host too as grabby_native_app_testing
+
+using namespace std;
+using namespace std::chrono;
+
+struct replay_frame
+{
+	long long t;
+	string type;
+	string frame;
+	steady_clock::time_point sentAt;
+	steady_clock::time_point repliedAt;
+	bool replied;
+};
+
+struct replay_state
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	vector<replay_frame> frames;
+	int replies = 0;
+	unsigned long outFrames = 0;
+	unsigned long long outBytes = 0;
+};
+
+static bool readFull(int fd, char *buf, size_t len)
+{
+	while(len > 0)
+	{
+		ssize_t r = read(fd, buf, len);
+		if(r == -1 && errno == EINTR) continue;
+		if(r <= 0) return false;
+		buf += r;
+		len -= r;
+	}
+	return true;
+}
+
+static bool writeFull(int fd, const char *buf, size_t len)
+{
+	while(len > 0)
+	{
+		ssize_t w = write(fd, buf, len);
+		if(w == -1 && errno == EINTR) continue;
+		if(w <= 0) return false;
+		buf += w;
+		len -= w;
+	}
+	return true;
+}
+
+//the value of a "key":"value" pair in a raw JSON text, without parsing it
+static string rawStringField(const string &json, const string &key)
+{
+	size_t pos = json.find("\"" + key + "\"");
+	if(pos == string::npos) return "";
+	pos = json.find(':', pos);
+	if(pos == string::npos) return "";
+	pos = json.find('"', pos);
+	if(pos == string::npos) return "";
+	size_t end = json.find('"', pos + 1);
+	if(end == string::npos) return "";
+	return json.substr(pos + 1, end - pos - 1);
+}
+
+//reads the inbound frames of a capture, lines look like {"t":123,"dir":"in","frame":{...}}
+static vector<replay_frame> loadCapture(const char *path)
+{
+	vector<replay_frame> frames;
+	ifstream file(path);
+	string line;
+
+	while(getline(file, line))
+	{
+		if(line.find("\"dir\":\"in\"") == string::npos) continue;
+
+		size_t framePos = line.find("\"frame\":");
+		size_t end = line.find_last_of('}');
+		if(framePos == string::npos || end == string::npos || end <= framePos) continue;
+
+		replay_frame f;
+		f.t = atoll(line.c_str() + line.find(':') + 1);
+		f.frame = line.substr(framePos + 8, end - framePos - 8);
+		f.type = rawStringField(f.frame, "type");
+		f.replied = false;
+		frames.push_back(f);
+	}
+
+	return frames;
+}
+
+//reads the replies of the host and matches them to requests by the ids we gave the requests
+static void reader_th(int fd, replay_state *state)
+{
+	const string idPrefix = "replay-";
+	uint32_t length;
+	string frame;
+
+	while(readFull(fd, (char*)&length, 4))
+	{
+		frame.resize(length);
+		if(!readFull(fd, &frame[0], length)) break;
+
+		steady_clock::time_point now = steady_clock::now();
+
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->outFrames++;
+		state->outBytes += 4 + length;
+
+		size_t pos = frame.find(idPrefix);
+		if(pos != string::npos)
+		{
+			size_t index = atoi(frame.c_str() + pos + idPrefix.length());
+			if(index < state->frames.size() && !state->frames[index].replied)
+			{
+				state->frames[index].replied = true;
+				state->frames[index].repliedAt = now;
+				state->replies++;
+			}
+		}
+
+		state->cond.notify_all();
+	}
+}
+
+static int run(int argc, char *argv[])
+{
+	const char *hostExe = argv[1];
+	const char *capture = argv[2];
+	double speed = 1;
+	int waitSeconds = 30;
+
+	for(int i=3; i+1<argc; i+=2)
+	{
+		string opt = argv[i];
+		if(opt == "--speed") speed = atof(argv[i+1]);
+		else if(opt == "--wait") waitSeconds = atoi(argv[i+1]);
+		else if(opt == "--entries") setenv("GRABBY_STUB_ENTRIES", argv[i+1], 1);
+		else if(opt == "--delay") setenv("GRABBY_STUB_DELAY", argv[i+1], 1);
+	}
+
+	replay_state state;
+	state.frames = loadCapture(capture);
+	if(state.frames.size() == 0)
+	{
+		fprintf(stderr, "no inbound messages in %s\n", capture);
+		return 1;
+	}
+
+	//the host runs this executable as its yt-dlp and doesn't show save dialogs
+	char self[PATH_MAX] = {0};
+	char dir[] = "/tmp/grabby-replay-XXXXXX";
+	if(readlink("/proc/self/exe", self, sizeof(self) - 1) == -1 || mkdtemp(dir) == NULL)
+	{
+		fprintf(stderr, "could not set up the stub - errno: %d\n", errno);
+		return 1;
+	}
+	string stub = string(dir) + "/yt-dlp-stub";
+	string saveDir = string(dir) + "/out/";
+	if(symlink(self, stub.c_str()) != 0 || mkdir(saveDir.c_str(), 0700) != 0)
+	{
+		fprintf(stderr, "could not set up the stub in %s - errno: %d\n", dir, errno);
+		unlink(stub.c_str());
+		rmdir(dir);
+		return 1;
+	}
+	setenv("GRABBY_YTDL", stub.c_str(), 1);
+	setenv("GRABBY_SAVE_DIR", saveDir.c_str(), 1);
+	unsetenv("GRABBY_RECORD");
+
+	vector<const char*> args;
+	args.push_back(hostExe);
+	args.push_back(NULL);
+
+	spawned_child host;
+	try
+	{
+		host = spawner::spawn(args);
+	}
+	catch(exception &e)
+	{
+		fprintf(stderr, "could not start the host - %s\n", e.what());
+		unlink(stub.c_str());
+		rmdir(saveDir.c_str());
+		rmdir(dir);
+		return 1;
+	}
+	pid_t pid = host.pid;
+	int hostIn = host.in;
+	int hostOut = host.out;
+
+	std::thread reader(reader_th, hostOut, &state);
+
+	//send the messages with their original spacing divided by speed
+	steady_clock::time_point start = steady_clock::now();
+	long long t0 = state.frames[0].t;
+
+	for(size_t i=0; i<state.frames.size(); i++)
+	{
+		replay_frame &f = state.frames[i];
+
+		if(speed > 0)
+		{
+			this_thread::sleep_until(start + microseconds((long long)((f.t - t0) * 1000 / speed)));
+		}
+
+		//give every request an id so its reply can be found, the parser keeps the first of duplicate keys
+		string frame = f.frame;
+		size_t brace = frame.find('{');
+		if(brace != string::npos)
+		{
+			size_t next = frame.find_first_not_of(" \t\r\n", brace + 1);
+			bool empty = (next != string::npos && frame[next] == '}');
+			frame.insert(brace + 1, "\"requestId\":\"replay-" + to_string(i) + "\"" + (empty? "" : ","));
+		}
+
+		uint32_t length = frame.length();
+
+		{
+			std::lock_guard<std::mutex> lock(state.mutex);
+			f.sentAt = steady_clock::now();
+		}
+
+		if(!writeFull(hostIn, (char*)&length, 4) || !writeFull(hostIn, frame.data(), length))
+		{
+			fprintf(stderr, "the host stopped reading at message %zu\n", i);
+			break;
+		}
+	}
+
+	steady_clock::time_point sent = steady_clock::now();
+
+	{
+		std::unique_lock<std::mutex> lock(state.mutex);
+		state.cond.wait_for(lock, seconds(waitSeconds), [&state](){ return state.replies == (int)state.frames.size(); });
+	}
+
+	steady_clock::time_point end = steady_clock::now();
+
+	close(hostIn);
+	reader.join();
+	close(hostOut);
+	waitpid(pid, NULL, 0);
+
+	unlink(stub.c_str());
+	rmdir(saveDir.c_str());
+	rmdir(dir);
+
+	//report
+	vector<double> latencies;
+	printf("%-6s %-22s %12s\n", "#", "type", "latency(ms)");
+	for(size_t i=0; i<state.frames.size(); i++)
+	{
+		replay_frame &f = state.frames[i];
+		if(f.replied)
+		{
+			double ms = duration_cast<microseconds>(f.repliedAt - f.sentAt).count() / 1000.0;
+			latencies.push_back(ms);
+			printf("%-6zu %-22s %12.3f\n", i, f.type.c_str(), ms);
+		}
+		else
+		{
+			printf("%-6zu %-22s %12s\n", i, f.type.c_str(), "no reply");
+		}
+	}
+
+	double sendSecs = duration_cast<microseconds>(sent - start).count() / 1e6;
+	double totalSecs = duration_cast<microseconds>(end - start).count() / 1e6;
+
+	printf("\nsent %zu messages in %.3fs (%.1f msg/s)\n", state.frames.size(), sendSecs,
+			sendSecs > 0? state.frames.size() / sendSecs : 0.0);
+	printf("received %lu messages, %llu bytes in %.3fs (%.1f msg/s, %.3f MB/s)\n", state.outFrames, state.outBytes,
+			totalSecs, state.outFrames / totalSecs, state.outBytes / totalSecs / 1e6);
+
+	if(latencies.size() > 0)
+	{
+		sort(latencies.begin(), latencies.end());
+		double sum = 0;
+		for(size_t i=0; i<latencies.size(); i++) sum += latencies[i];
+		printf("latency of %zu replied requests (ms): min %.3f avg %.3f p50 %.3f p95 %.3f p99 %.3f max %.3f\n",
+				latencies.size(), latencies.front(), sum / latencies.size(),
+				latencies[latencies.size() * 50 / 100], latencies[latencies.size() * 95 / 100],
+				latencies[latencies.size() * 99 / 100], latencies.back());
+	}
+
+	return 0;
+}
+
+static bool isStub(const char *argv0)
+{
+	const char *name = strrchr(argv0, '/');
+	name = (name == NULL)? argv0 : name + 1;
+	return strcmp(name, "yt-dlp-stub") == 0;
+}
+
+//behaves like yt-dlp as far as the host can tell, without touching the network
+static int ytdlStub(int argc, char *argv[])
+{
+	const char *entriesEnv = getenv("GRABBY_STUB_ENTRIES");
+	const char *delayEnv = getenv("GRABBY_STUB_DELAY");
+	int entries = entriesEnv? atoi(entriesEnv) : 1;
+	int delay = delayEnv? atoi(delayEnv) : 20;
+	const char *url = (argc > 1)? argv[1] : "";
+
+	bool info = false;
+	for(int i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-j") == 0) info = true;
+	}
+
+	if(info)
+	{
+		if(entries <= 1)
+		{
+			printf("{\"id\": \"stub\", \"title\": \"stub video\", \"webpage_url\": \"%s\", \"duration\": 212, "
+					"\"formats\": [{\"format_id\": \"18\", \"ext\": \"mp4\", \"width\": 640, \"height\": 360, "
+					"\"fps\": 30, \"tbr\": 512.3, \"filesize\": 123456789}, {\"format_id\": \"22\", \"ext\": \"mp4\", "
+					"\"width\": 1280, \"height\": 720, \"fps\": 30, \"tbr\": 1210.7, \"filesize\": 987654321}], "
+					"\"tags\": [\"stub\"], \"description\": \"a stub\"}\n", url);
+		}
+		else
+		{
+			for(int i=0; i<entries; i++)
+			{
+				printf("{\"_type\": \"url\", \"id\": \"stub%d\", \"title\": \"stub video %d\", \"url\": \"%s?v=%d\", "
+						"\"duration\": %d}\n", i, i, url, i, 60 + i);
+			}
+		}
+		return 0;
+	}
+
+	for(int percent=0; percent<=100; percent+=10)
+	{
+		printf("%5.1f%%|1.00MiB/s|NA\n", (double)percent);
+		fflush(stdout);
+		usleep(delay * 1000);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	//the host runs this executable as its yt-dlp through the symlink made in run()
+	if(isStub(argv[0]))
+	{
+		return ytdlStub(argc, argv);
+	}
+
+	if(argc < 3)
+	{
+		fprintf(stderr, "usage: %s <host> <capture.jsonl> [--speed <factor>] [--wait <seconds>] "
+				"[--entries <n>] [--delay <ms>]\n", argv[0]);
+		return 1;
+	}
+
+	return run(argc, argv);
+}
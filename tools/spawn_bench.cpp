@@ -0,0 +1,206 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <exception>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "spawner.h"
+
+//measures how long starting a child takes with fork + exec and with posix_spawn while the host is under pressure
+//usage: grabby_spawn_bench [--count <n>] [--memory <MB>] [--threads <n>] [--exe <path>]
+//--memory is allocated and touched up front, --threads keep writing to it while the children are started
+//every child is started with its stdin and stdout on pipes like ytdl is, and waited for before the next one
+//
+//this is a benchmark with a main of its own, it isn't part of the host build
+//make -C tools builds it with spawner.cpp, event_loop.cpp and exceptions.cpp of the host
+
+using namespace std;
+using namespace std::chrono;
+
+const size_t PAGE = 4096;
+
+struct bench_times
+{
+	vector<double> start;	//until the host can go on
+	vector<double> exit;	//until the child has run and been reaped
+};
+
+//how popen2 started children before the spawner, kept here to compare against
+static pid_t forkChild(const vector<const char*> &args, int *in, int *out)
+{
+	int inPipe[2], outPipe[2];
+	if(pipe2(inPipe, O_CLOEXEC) != 0 || pipe2(outPipe, O_CLOEXEC) != 0)
+	{
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		dup2(inPipe[0], STDIN_FILENO);
+		dup2(outPipe[1], STDOUT_FILENO);
+		execvp(args[0], const_cast<char* const*>(args.data()));
+		_exit(127);
+	}
+
+	close(inPipe[0]);
+	close(outPipe[1]);
+	*in = inPipe[1];
+	*out = outPipe[0];
+	return pid;
+}
+
+static bool startChild(bool useFork, const vector<const char*> &args, pid_t *pid, int *in, int *out)
+{
+	if(useFork)
+	{
+		*pid = forkChild(args, in, out);
+		return *pid != -1;
+	}
+
+	try
+	{
+		spawned_child child = spawner::spawn(args);
+		*pid = child.pid;
+		*in = child.in;
+		*out = child.out;
+		return true;
+	}
+	catch(exception &e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return false;
+	}
+}
+
+static bool measure(bool useFork, const vector<const char*> &args, int count, bench_times &times)
+{
+	for(int i=0; i<count; i++)
+	{
+		pid_t pid;
+		int in, out;
+
+		steady_clock::time_point t0 = steady_clock::now();
+		if(!startChild(useFork, args, &pid, &in, &out))
+		{
+			return false;
+		}
+		steady_clock::time_point t1 = steady_clock::now();
+
+		close(in);
+		char buf[4096];
+		ssize_t r;
+		while((r = read(out, buf, sizeof(buf))) > 0 || (r == -1 && errno == EINTR)){}
+		close(out);
+
+		int status;
+		while(waitpid(pid, &status, 0) == -1 && errno == EINTR){}
+		steady_clock::time_point t2 = steady_clock::now();
+
+		times.start.push_back(duration_cast<nanoseconds>(t1 - t0).count() / 1e6);
+		times.exit.push_back(duration_cast<nanoseconds>(t2 - t0).count() / 1e6);
+	}
+	return true;
+}
+
+static void report(const char *name, vector<double> &ms)
+{
+	sort(ms.begin(), ms.end());
+	double sum = 0;
+	for(size_t i=0; i<ms.size(); i++) sum += ms[i];
+	printf("%-18s min %8.3f avg %8.3f p50 %8.3f p95 %8.3f p99 %8.3f max %8.3f\n", name,
+			ms.front(), sum / ms.size(), ms[ms.size() * 50 / 100], ms[ms.size() * 95 / 100],
+			ms[ms.size() * 99 / 100], ms.back());
+}
+
+//writes to every page of the ballast so the pages stay dirty while the children are started
+static void pressure_th(char *ballast, size_t size, atomic<bool> *stop)
+{
+	unsigned char n = 0;
+	while(!stop->load(memory_order_relaxed))
+	{
+		for(size_t i=0; i<size && !stop->load(memory_order_relaxed); i+=PAGE)
+		{
+			ballast[i] = n;
+		}
+		n++;
+		if(size == 0) this_thread::sleep_for(milliseconds(1));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int count = 200;
+	size_t memoryMB = 0;
+	int threads = 0;
+	const char *exe = "true";
+
+	for(int i=1; i+1<argc; i+=2)
+	{
+		string opt = argv[i];
+		if(opt == "--count") count = atoi(argv[i+1]);
+		else if(opt == "--memory") memoryMB = atol(argv[i+1]);
+		else if(opt == "--threads") threads = atoi(argv[i+1]);
+		else if(opt == "--exe") exe = argv[i+1];
+	}
+	if(count < 1) count = 1;
+
+	//touched so that it is mapped, that's what fork has to copy the page tables of
+	size_t size = memoryMB * 1024 * 1024;
+	char *ballast = NULL;
+	if(size > 0)
+	{
+		ballast = (char *)malloc(size);
+		if(ballast == NULL)
+		{
+			fprintf(stderr, "could not allocate %zu MB\n", memoryMB);
+			return 1;
+		}
+		memset(ballast, 1, size);
+	}
+
+	atomic<bool> stop(false);
+	vector<std::thread> pressure;
+	for(int i=0; i<threads; i++)
+	{
+		pressure.push_back(std::thread(pressure_th, ballast, size, &stop));
+	}
+
+	vector<const char*> args;
+	args.push_back(exe);
+	args.push_back(NULL);
+
+	printf("starting %s %d times with %zu MB touched and %d threads writing to it (ms)\n", exe, count, memoryMB, threads);
+	fflush(stdout);
+
+	bench_times forked, spawned;
+	bool ok = measure(true, args, count, forked) && measure(false, args, count, spawned);
+
+	stop = true;
+	for(size_t i=0; i<pressure.size(); i++)
+	{
+		pressure[i].join();
+	}
+	free(ballast);
+
+	if(!ok)
+	{
+		fprintf(stderr, "could not start %s\n", exe);
+		return 1;
+	}
+
+	report("fork start", forked.start);
+	report("fork exit", forked.exit);
+	report("posix_spawn start", spawned.start);
+	report("posix_spawn exit", spawned.exit);
+
+	return 0;
+}
@@ -1,9 +1,38 @@
 #pragma once
 
+#include <string>
+#include <string_view>
+#include <functional>
 #include "wintypes.h"
 
+//what a process and the children it has waited for have used, from wait4
+struct process_usage
+{
+	long long wallMs;
+	long long cpuUserMs;
+	long long cpuSysMs;
+	long long maxRssKB;
+	long long readBytes;		//block I/O, reads served from the page cache don't count
+	long long writeBytes;
+};
+
 struct process_result
 {
 	DWORD exitCode;
 	std::string output;
+	process_usage usage;
+};
+
+//how much of what a process writes to its stdout ends up in process_result.output
+enum output_retention
+{
+	RETAIN_ALL,		//everything, for output that is parsed once the process exits
+	RETAIN_TAIL		//the last OUTPUT_TAIL_LEN bytes, for long running processes whose output is handled as it comes
 };
+
+//a line of the output of a process with its newline, as it is read
+//the last line of the output may not have one
+typedef std::function<void(std::string_view line)> line_callback;
+
+//the result isn't used after the callback, it can be moved out of
+typedef std::function<void(process_result &res)> exit_callback;
@@ -1,13 +1,23 @@
 #define _GNU_SOURCE
 
 #include <mutex>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <thread>
 #include <sstream>
+#include <algorithm>
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 #include <plog/Log.h>
 #include <plog/Initializers/RollingFileInitializer.h>
 #include "utils.h"
@@ -15,13 +25,56 @@
 #include "defines.h"
 #include "tinyfiledialogs.h"
 #include "kill_switches.h"
+#include "event_loop.h"
+#include "spawner.h"
 
 
 using namespace std;
 using namespace ggicci;
+using namespace std::chrono;
 
 
+struct child_job
+{
+	pid_t pid;
+	int fd;
+	int pidfd;					//-1 without pidfds, the exit is then polled for once stdout has closed
+	bool reaped;
+	int status;					//-1 if it couldn't be read
+	struct rusage rusage;
+	steady_clock::time_point startedAt;
+	steady_clock::time_point reapedAt;
+	std::string killSwitch;
+	line_callback callback;
+	exit_callback onExit;
+	output_retention retention;
+	std::string out;			//with RETAIN_TAIL a ring of OUTPUT_TAIL_LEN bytes
+	size_t outHead;				//where the ring continues
+	bool outWrapped;
+	std::vector<char> buf;		//read buffer, starts with the part of a line whose newline hasn't been read yet
+	size_t pending;
+	bool paused;				//its stdout isn't watched until the callback has caught up, see pauseOutput()
+	bool killed;
+	int killStage;				//the last signal sent to the group, see watchCancel()
+	steady_clock::time_point killedAt;
+	int cancelTimer;
+};
+
+//how much of the output of a child is read at once, lines longer than this make the buffer grow
+const size_t CHILD_READ_SIZE = 64 * 1024;
+//asked for the stdout pipe of a child so it can print a burst of output without waiting for the host
+const int CHILD_PIPE_SIZE = 256 * 1024;
+//a cancelled process group gets SIGINT, SIGTERM if it's still there after CANCEL_TERM_MS and SIGKILL after CANCEL_KILL_MS
+const int CANCEL_TERM_MS = 3000;
+const int CANCEL_KILL_MS = 5000;
+//how often a cancelled group is checked for being gone, this is the resolution of the measured latency
+const int CANCEL_CHECK_MS = 20;
+
 std::mutex guiMutex;
+//only accessed from the event loop thread
+std::map<pid_t, std::shared_ptr<child_job>> runningJobs;
+//the job whose output is being handed to its callback by the event loop
+std::shared_ptr<child_job> feedingJob;
 
 
 utils::utils(void)
@@ -33,10 +86,15 @@ utils::~utils(void)
 }
 
 Json utils::parseJSON(const string &JSONstr)
+{
+	return parseJSON(JSONstr.c_str());
+}
+
+Json utils::parseJSON(const char *JSONstr)
 {
 	try
 	{
-		Json json = Json::Parse(JSONstr.c_str());
+		Json json = Json::Parse(JSONstr);
 		return json;
 	}
 	catch (exception& e)
@@ -47,8 +105,27 @@ Json utils::parseJSON(const string &JSONstr)
 	}
 }
 
-process_result utils::launchExe(const string &exeName, const vector<string> &args, const string &input,
-		const string &killSwitch, output_callback *callback)
+//the strings of the result point into JSONstr, so it must outlive the result (copies are fine)
+//parses into the arena of document if it is one, see Json::Parse(string_view, bool)
+//values matching the filter are skipped without being parsed
+Json utils::parseJSONInSitu(string_view JSONstr, const Json &document, const JsonFilter *filter)
+{
+	try
+	{
+		Json json = Json::ParseInSitu(JSONstr, document, filter);
+		return json;
+	}
+	catch (exception& e)
+	{
+		string msg = "Error parsing JSON: ";
+		msg.append(e.what());
+		throw grb_exception(msg.c_str());
+	}
+}
+
+//launches the process in a process group of its own and writes the input to its stdin
+//the stdin of the returned child is already closed
+static spawned_child startChild(const string &exeName, const vector<string> &args, const string &input, bool pidfd)
 {
 	if(exeName.length() > MAX_PATH)
 	{
@@ -57,122 +134,598 @@ process_result utils::launchExe(const string &exeName, const vector<string> &arg
 
 	vector<const char*> _args = utils::getExecArgs(exeName, args);
 
-	int ch_fd_input, ch_fd_output;
+	spawn_options options;
+	options.pipeSize = CHILD_PIPE_SIZE;
+	options.newGroup = true;
+	options.pidfd = pidfd;
 
-	// If an error occurs, exit the application.
-	int pid = utils::popen2(_args, &ch_fd_input, &ch_fd_output);
-	if(pid == -1)
+	spawned_child child = spawner::spawn(_args, options);
+	int ch_fd_input = child.in;
+
+	//write the input to the STDIN of the launched process
+	size_t written = 0;
+	while(written < input.length())
 	{
-		string msg = "popen2() failed";
-		throw grb_exception(msg.c_str());
+		ssize_t w = write(ch_fd_input, input.data() + written, input.length() - written);
+
+		if(w == -1 && errno == EINTR) continue;
+
+		if(w <= 0)
+		{
+			PLOG_ERROR << "process stdin write failed - errno: " << errno;
+			//TODO: error
+			break;
+		}
+
+		written += w;
 	}
 
-	FILE* ch_inStream = fdopen(ch_fd_input, "w");
-	FILE* ch_outStream = fdopen(ch_fd_output, "r");
+	close(ch_fd_input);
+	child.in = -1;
 
-	if(ch_inStream==NULL || ch_outStream==NULL)
+	return child;
+}
+
+//returns the first newline from p, or end
+//blocks of 32 or 16 bytes without one are skipped with a single comparison
+static const char* findNewline(const char *p, const char *end)
+{
+#if defined(__AVX2__)
+	const __m256i nl32 = _mm256_set1_epi8('\n');
+	while(end - p >= 32)
 	{
-		string msg = "fdopen failed - errno: " + errno;
-		PLOG_ERROR << msg;
-		throw grb_exception(msg.c_str());
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl32));
+		if(mask != 0) return p + __builtin_ctz(mask);
+		p += 32;
 	}
+#endif
+#if defined(__SSE2__)
+	const __m128i nl16 = _mm_set1_epi8('\n');
+	while(end - p >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl16));
+		if(mask != 0) return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while(p < end && *p != '\n')
+	{
+		p++;
+	}
+	return p;
+}
 
-	//write the input to the STDIN of the launched process
-	if(input.length() > 0)
+//keeps what the process has written as the retention of the job says
+static void retainOutput(child_job &job, const char *data, size_t len)
+{
+	if(job.retention == RETAIN_ALL)
+	{
+		job.out.append(data, len);
+		return;
+	}
+
+	if(job.out.empty())
 	{
-		DWORD dwWritten;
-		DWORD dataLen = input.length();
+		job.out.resize(OUTPUT_TAIL_LEN);
+	}
 
-		dwWritten = fwrite(input.c_str(), sizeof(char), dataLen, ch_inStream);
-		fflush(stdout);
+	size_t size = job.out.size();
+	if(len >= size)
+	{
+		memcpy(job.out.data(), data + len - size, size);
+		job.outHead = 0;
+		job.outWrapped = true;
+		return;
+	}
 
-		if(dwWritten!=dataLen)
+	size_t first = min(len, size - job.outHead);
+	memcpy(job.out.data() + job.outHead, data, first);
+	memcpy(job.out.data(), data + first, len - first);
+
+	if(job.outHead + len >= size)
+	{
+		job.outWrapped = true;
+	}
+	job.outHead = (job.outHead + len) % size;
+}
+
+//the output is moved out of the job, it can be called once
+static string retainedOutput(child_job &job)
+{
+	if(job.retention == RETAIN_ALL)
+	{
+		return std::move(job.out);
+	}
+
+	if(!job.outWrapped)
+	{
+		return string(job.out.begin(), job.out.begin() + job.outHead);
+	}
+
+	string tail;
+	tail.reserve(job.out.size());
+	tail.append(job.out.begin() + job.outHead, job.out.end());
+	tail.append(job.out.begin(), job.out.begin() + job.outHead);
+
+	//the oldest line has lost its start, the tail begins with the next one
+	size_t nl = tail.find('\n');
+	if(nl != string::npos && nl + 1 < tail.length())
+	{
+		tail.erase(0, nl + 1);
+	}
+
+	return tail;
+}
+
+//the output can be the info of a whole playlist, all of it is only worth logging when the process failed
+static void logOutput(const process_result &res)
+{
+	PLOG_INFO << "process output is " << res.output.length() << " bytes";
+
+	if(res.exitCode != 0 && res.output.length() > 0)
+	{
+		size_t from = (res.output.length() > OUTPUT_TAIL_LEN)? res.output.length() - OUTPUT_TAIL_LEN : 0;
+		PLOG_INFO << "end of process output: " << res.output.substr(from);
+	}
+}
+
+//reads what the child has written into the free part of the read buffer, returns what read() returned
+static ssize_t readOutput(child_job &job)
+{
+	//a line that fills the whole buffer needs a bigger one
+	if(job.buf.size() - job.pending < CHILD_READ_SIZE / 2)
+	{
+		job.buf.resize(max(CHILD_READ_SIZE, job.buf.size() * 2));
+	}
+
+	return read(job.fd, job.buf.data() + job.pending, job.buf.size() - job.pending);
+}
+
+//takes the len bytes that readOutput() has just put in the read buffer
+//and passes every complete line to the callback as a view into the buffer
+static void feedOutput(child_job &job, size_t len)
+{
+	char *buf = job.buf.data();
+	retainOutput(job, buf + job.pending, len);
+
+	if(!job.callback)
+	{
+		job.pending = 0;
+		return;
+	}
+
+	//the pending part has no newline, so only the new bytes are scanned
+	const char *end = buf + job.pending + len;
+	const char *start = buf;
+	const char *nl = buf + job.pending;
+	while((nl = findNewline(nl, end)) != end)
+	{
+		job.callback(string_view(start, nl - start + 1));
+		start = ++nl;
+	}
+
+	job.pending = end - start;
+	if(start != buf && job.pending > 0)
+	{
+		memmove(buf, start, job.pending);
+	}
+}
+
+//the process has closed its stdout, a last line without a newline still goes to the callback
+static void flushOutput(child_job &job)
+{
+	if(job.callback && job.pending > 0)
+	{
+		job.callback(string_view(job.buf.data(), job.pending));
+	}
+	job.pending = 0;
+}
+
+//checks on a cancelled process group until all of its processes are gone and logs how long that took
+//the signals get stronger for a group that doesn't go away
+static void watchCancel(shared_ptr<child_job> job)
+{
+	long long ms = duration_cast<milliseconds>(steady_clock::now() - job->killedAt).count();
+
+	if(kill(-job->pid, 0) == -1 && errno == ESRCH)
+	{
+		eventloop::cancelTimer(job->cancelTimer);
+		PLOG_INFO << "process group " << job->pid << " is gone " << ms << "ms after it was cancelled";
+		return;
+	}
+
+	if(job->killStage == SIGINT && ms >= CANCEL_TERM_MS)
+	{
+		PLOG_INFO << "process group " << job->pid << " ignored SIGINT, sending SIGTERM";
+		kill(-job->pid, SIGTERM);
+		job->killStage = SIGTERM;
+	}
+	else if(job->killStage == SIGTERM && ms >= CANCEL_KILL_MS)
+	{
+		PLOG_INFO << "process group " << job->pid << " ignored SIGTERM, sending SIGKILL";
+		kill(-job->pid, SIGKILL);
+		job->killStage = SIGKILL;
+	}
+	else if(job->killStage == SIGKILL && ms >= CANCEL_KILL_MS + 1000)
+	{
+		//a process that changed its group or user can't be followed
+		eventloop::cancelTimer(job->cancelTimer);
+		PLOG_ERROR << "process group " << job->pid << " is still there " << ms << "ms after it was cancelled";
+	}
+}
+
+//signals the whole process group, so ffmpeg and whatever else ytdl has started stops with it
+static void killChild(shared_ptr<child_job> job)
+{
+	if(job->killed)
+	{
+		return;
+	}
+
+	PLOG_INFO << "killing process group " << job->pid;
+	kill(-job->pid, SIGINT);
+	job->killed = true;
+	job->killStage = SIGINT;
+	job->killedAt = steady_clock::now();
+	job->cancelTimer = eventloop::addTimer(CANCEL_CHECK_MS, true, [job](){ watchCancel(job); });
+}
+
+//the rusage of a process reaped with wait4 includes the children it has reaped itself, like ffmpeg for ytdl
+static process_usage usageOf(const child_job &job)
+{
+	process_usage usage;
+	usage.wallMs = duration_cast<milliseconds>(job.reapedAt - job.startedAt).count();
+	usage.cpuUserMs = (long long)job.rusage.ru_utime.tv_sec * 1000 + job.rusage.ru_utime.tv_usec / 1000;
+	usage.cpuSysMs = (long long)job.rusage.ru_stime.tv_sec * 1000 + job.rusage.ru_stime.tv_usec / 1000;
+	usage.maxRssKB = job.rusage.ru_maxrss;
+	//counted in blocks of 512 bytes
+	usage.readBytes = (long long)job.rusage.ru_inblock * 512;
+	usage.writeBytes = (long long)job.rusage.ru_oublock * 512;
+	return usage;
+}
+
+//reaps the process if it has exited, returns what waitpid would
+static pid_t waitChild(child_job &job, int options)
+{
+	int status = 0;
+	pid_t r;
+	do{
+		r = wait4(job.pid, &status, options, &job.rusage);
+	}while(r == -1 && errno == EINTR);
+
+	if(r != 0)
+	{
+		job.reaped = true;
+		job.status = (r > 0)? status : -1;
+		job.reapedAt = steady_clock::now();
+		if(r == -1)
 		{
-			PLOG_ERROR << "process stdin write failed - errno: " + errno;
-			//TODO: error
+			memset(&job.rusage, 0, sizeof(job.rusage));
 		}
 	}
 
-	fclose(ch_inStream);
+	return r;
+}
 
-	//we read the output of the process
-	const int BUFSIZE = 1024;
-	char buf[BUFSIZE];
-	unsigned long bytesRead = 0;
-	unsigned long totalRead = 0;
-	vector<char> out;
+//same as watchCancel() for launchExe(), blocks until the cancelled process has exited
+//only the process itself is waited for, what is left of its group gets the signals it got up to then
+static void waitKilled(child_job &job)
+{
+	while(waitChild(job, WNOHANG) == 0)
+	{
+		long long ms = duration_cast<milliseconds>(steady_clock::now() - job.killedAt).count();
 
-	//keep reading process output until it exits or we receive a kill command
+		if(job.killStage == SIGINT && ms >= CANCEL_TERM_MS)
+		{
+			PLOG_INFO << "process group " << job.pid << " ignored SIGINT, sending SIGTERM";
+			kill(-job.pid, SIGTERM);
+			job.killStage = SIGTERM;
+		}
+		else if(job.killStage == SIGTERM && ms >= CANCEL_KILL_MS)
+		{
+			PLOG_INFO << "process group " << job.pid << " ignored SIGTERM, sending SIGKILL";
+			kill(-job.pid, SIGKILL);
+			job.killStage = SIGKILL;
+			waitChild(job, 0);
+			return;
+		}
+
+		this_thread::sleep_for(milliseconds(CANCEL_CHECK_MS));
+	}
+}
+
+//called once the process has exited and its stdout has closed
+static void finishChild(shared_ptr<child_job> job)
+{
+	runningJobs.erase(job->pid);
+
+	DWORD exitCode = 1;
+	if(WIFEXITED(job->status)){
+		exitCode = WEXITSTATUS(job->status);
+	}
+
+	PLOG_INFO << "process exit code is " << exitCode;
+
+	//how ytdl exits when it is cancelled on windows, so a cancel looks the same everywhere
+	if(job->killed)
+	{
+		exitCode = YTDL_CANCEL_CODE;
+	}
+
+	process_result res;
+	res.exitCode = exitCode;
+	res.output = retainedOutput(*job);
+	res.usage = usageOf(*job);
+
+	logOutput(res);
+
+	job->onExit(res);
+}
+
+//the pidfd of the process is readable, it has exited
+static void onChildExit(shared_ptr<child_job> job)
+{
+	if(waitChild(*job, WNOHANG) == 0)
+	{
+		return;
+	}
+
+	eventloop::unwatchFd(job->pidfd);
+	close(job->pidfd);
+	job->pidfd = -1;
+
+	//there can still be output in the pipe, or a child of the process can still be writing to it
+	if(job->fd == -1)
+	{
+		finishChild(job);
+	}
+}
+
+//without a pidfd the exit is polled for once the process has closed its stdout
+static void reapChild(shared_ptr<child_job> job)
+{
+	//the process has closed its stdout but hasn't exited yet, check again later
+	if(waitChild(*job, WNOHANG) == 0)
+	{
+		eventloop::addTimer(50, false, [job](){ reapChild(job); });
+		return;
+	}
+
+	finishChild(job);
+}
+
+static void onChildOutput(shared_ptr<child_job> job)
+{
 	while(true)
 	{
-		if(feof(ch_outStream)){
-			break;
-		}
+		ssize_t bytesRead = readOutput(*job);
 
-		//fgets returns when it reaches a carriage return or eof
-		if(fgets(buf, BUFSIZE, ch_outStream) == NULL)
+		if(bytesRead > 0)
 		{
-			if(ferror(ch_outStream))
+			feedingJob = job;
+			try
+			{
+				feedOutput(*job, bytesRead);
+			}
+			catch(...)
 			{
-				PLOG_INFO << "error reading output from process - ferror: " << ferror(ch_outStream);
+				feedingJob.reset();
+				throw;
 			}
+			feedingJob.reset();
 
-			break;
+			//the callback can't keep up, the rest is read once it resumes the output
+			if(job->paused)
+			{
+				return;
+			}
+			continue;
 		}
 
-		bytesRead = strlen(buf);
-		out.reserve(BUFSIZE);
-		out.insert(out.end(), buf, buf+bytesRead);
-		totalRead += bytesRead;
+		if(bytesRead == -1 && errno == EINTR) continue;
+
+		if(bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+		if(bytesRead == -1)
+		{
+			PLOG_INFO << "error reading output from process - errno: " << errno;
+		}
 
-		string o(buf, buf+bytesRead);
+		//process closed its output
+		flushOutput(*job);
+		eventloop::unwatchFd(job->fd);
+		close(job->fd);
+		job->fd = -1;
 
-		//pass output to callback function
-		if(callback != NULL)
+		if(job->reaped)
 		{
-			string outStr(buf, buf+bytesRead);
-			callback->call(outStr);
+			finishChild(job);
 		}
+		else if(job->pidfd == -1)
+		{
+			reapChild(job);
+		}
+		return;
+	}
+
+	if(killswitches::isActive(job->killSwitch))
+	{
+		killChild(job);
+	}
+}
+
+process_result utils::launchExe(const string &exeName, const vector<string> &args, const string &input,
+		const string &killSwitch, line_callback callback, output_retention retention)
+{
+	spawned_child child = startChild(exeName, args, input, false);
+
+	child_job job;
+	job.pid = child.pid;
+	job.fd = child.out;
+	job.startedAt = steady_clock::now();
+	job.retention = retention;
+	job.outHead = 0;
+	job.outWrapped = false;
+	job.pending = 0;
+	job.killed = false;
+	job.callback = callback;
+
+	//keep reading process output until it exits or we receive a kill command
+	while(true)
+	{
+		ssize_t bytesRead = readOutput(job);
+
+		if(bytesRead == -1 && errno == EINTR) continue;
+
+		if(bytesRead <= 0)
+		{
+			if(bytesRead == -1)
+			{
+				PLOG_INFO << "error reading output from process - errno: " << errno;
+			}
+
+			flushOutput(job);
+			break;
+		}
+
+		feedOutput(job, bytesRead);
 
 		if(killswitches::isActive(killSwitch))
 		{
-			kill(pid, SIGINT);
+			PLOG_INFO << "killing process group " << job.pid;
+			kill(-job.pid, SIGINT);
+			job.killed = true;
+			job.killStage = SIGINT;
+			job.killedAt = steady_clock::now();
 			break;
 		}
 	}
 
 	// wait for process to exit and check its exit code
-	fclose(ch_outStream);
-	close(ch_fd_output);
+	close(job.fd);
 
-	int status;
-	int r;
-	do{
-		int r = waitpid(pid, &status, 0);
-	}while (r == -1 && errno == EINTR);
+	if(job.killed)
+	{
+		waitKilled(job);
+	}
+	else
+	{
+		waitChild(job, 0);
+	}
 
 	DWORD exitCode = 1;
-	if(WIFEXITED(status)){
-		exitCode = WEXITSTATUS(status);
+	if(WIFEXITED(job.status)){
+		exitCode = WEXITSTATUS(job.status);
 	}
 
 	PLOG_INFO << "process exit code is " << exitCode;
 
 	process_result res;
 	res.exitCode = exitCode;
+	res.output = retainedOutput(job);
+	res.usage = usageOf(job);
 
-	if(totalRead<=0)
+	logOutput(res);
+
+	return res;
+}
+
+//same as launchExe() but the output is read by the event loop and onExit is called when the process exits
+//must be called on the event loop thread
+void utils::launchExeAsync(const string &exeName, const vector<string> &args, const string &input,
+		const string &killSwitch, line_callback callback, exit_callback onExit, output_retention retention)
+{
+	spawned_child child = startChild(exeName, args, input, true);
+	pid_t pid = child.pid;
+	int ch_fd_output = child.out;
+
+	fcntl(ch_fd_output, F_SETFL, fcntl(ch_fd_output, F_GETFL) | O_NONBLOCK);
+
+	shared_ptr<child_job> job = make_shared<child_job>();
+	job->pid = pid;
+	job->fd = ch_fd_output;
+	job->pidfd = child.pidfd;
+	job->reaped = false;
+	job->status = -1;
+	job->startedAt = steady_clock::now();
+	job->killSwitch = killSwitch;
+	job->onExit = onExit;
+	job->retention = retention;
+	job->outHead = 0;
+	job->outWrapped = false;
+	job->pending = 0;
+	job->paused = false;
+	job->killed = false;
+	job->killStage = 0;
+	job->cancelTimer = 0;
+	job->callback = callback;
+
+	runningJobs[pid] = job;
+
+	try
 	{
-		res.output = "";
+		eventloop::watchFd(ch_fd_output, EPOLLIN, [job](uint32_t events){ onChildOutput(job); });
+		if(job->pidfd != -1)
+		{
+			eventloop::watchFd(job->pidfd, EPOLLIN, [job](uint32_t events){ onChildExit(job); });
+		}
 	}
-	else
+	catch(exception &e)
+	{
+		runningJobs.erase(pid);
+		eventloop::unwatchFd(ch_fd_output);
+		close(ch_fd_output);
+		if(job->pidfd != -1)
+		{
+			close(job->pidfd);
+		}
+		kill(-pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		throw;
+	}
+}
+
+//stops reading the output of the process whose line is being handled, for callbacks that fall behind
+//the process blocks once its pipe is full, so its output doesn't pile up in memory meanwhile
+//returns the function that starts reading again, it must be called on the event loop thread
+//can only be called from a line_callback of launchExeAsync(), anywhere else it does nothing
+function<void()> utils::pauseOutput()
+{
+	shared_ptr<child_job> job = feedingJob;
+	if(!job || job->paused)
 	{
-		res.output = string(out.begin(), out.end());
+		return [](){};
 	}
 
-	PLOG_INFO << "exe output be: " << res.output;
+	job->paused = true;
+	eventloop::unwatchFd(job->fd);
 
-	return res;
+	weak_ptr<child_job> paused = job;
+	return [paused](){
+		shared_ptr<child_job> job = paused.lock();
+		if(!job || !job->paused)
+		{
+			return;
+		}
+		job->paused = false;
+		eventloop::watchFd(job->fd, EPOLLIN, [job](uint32_t events){ onChildOutput(job); });
+	};
+}
+
+//kills the running processes whose kill switch has been activated
+//must be called on the event loop thread
+void utils::checkKillSwitches()
+{
+	map<pid_t, shared_ptr<child_job>>::iterator it = runningJobs.begin();
+	for(; it != runningJobs.end(); ++it)
+	{
+		if(killswitches::isActive(it->second->killSwitch))
+		{
+			killChild(it->second);
+		}
+	}
 }
 
 void utils::execCmd(string &exeName, vector<string> args, bool showConsole)
@@ -198,94 +751,13 @@ void utils::execCmd(string &exeName, vector<string> args, bool showConsole)
 
 	vector<const char*> _args = utils::getExecArgs(exeName, args);
 
-	int pid = fork();
+	//the host's stdin and stdout carry the messages of the browser, the command must not touch them
+	spawn_options options;
+	options.in = STDIO_NULL;
+	options.out = STDIO_NULL;
 
-	if(pid == 0)
-	{
-		execvp(_args[0], const_cast<char* const*>(_args.data()));
-		exit(0);
-	}
-}
-
-pid_t utils::popen2(vector<const char*> args, int *fd_input, int *fd_output)
-{
-	const int READ_END = 0;
-	const int WRITE_END = 1;
-
-    int p_child_stdin[2] = {0};
-    int p_child_stdout[2] = {0};
-    pid_t pid;
-
-    //create two set of pipes
-    if(pipe2(p_child_stdin, O_CLOEXEC) != 0 || pipe2(p_child_stdout, O_CLOEXEC) != 0)
-    {
-    	PLOG_ERROR << "failed to create pipes";
-    	return -1;
-    }
-
-    pid = fork();
-
-    // if fork failed
-    if(pid == -1)
-    {
-    	close(p_child_stdin[WRITE_END]);
-    	close(p_child_stdin[READ_END]);
-    	close(p_child_stdout[WRITE_END]);
-    	close(p_child_stdout[READ_END]);
-    	PLOG_ERROR << "failed to fork";
-    	return -1;
-    }
-
-    // in child process
-    else if(pid == 0)
-    {
-    	//closed pipes that the child doesn't need
-    	close(p_child_stdin[WRITE_END]);
-    	close(p_child_stdout[READ_END]);
-
-    	// gives "bad file descriptor" error when trying to read
-    	// also this is after the fork() so we don't need the CLOEXEC flags
-    	//dup3(p_child_stdin[READ_END], STDIN_FILENO, O_CLOEXEC);
-    	//dup3(p_child_stdout[WRITE_END], STDOUT_FILENO, O_CLOEXEC);
-
-    	dup2(p_child_stdin[READ_END], STDIN_FILENO);
-    	dup2(p_child_stdout[WRITE_END], STDOUT_FILENO);
-
-    	close(p_child_stdin[READ_END]);
-    	close(p_child_stdout[WRITE_END]);
-
-    	execvp(args[0], const_cast<char* const*>(args.data()));
-
-    	//we should not reach here
-    	printf("execvp failed");
-    	_exit(1);
-    }
-
-    // in parent process
-    else
-    {
-    	//closed pipes that the parent doesn't need
-    	close(p_child_stdin[READ_END]);
-    	close(p_child_stdout[WRITE_END]);
-
-    	// assign the read and write handles to the pointers passed to the function and return pid
-        if(fd_input == NULL){
-        	close(p_child_stdin[WRITE_END]);
-        }
-        else{
-        	*fd_input = p_child_stdin[WRITE_END];
-        }
-
-        if(fd_output == NULL)
-        {
-        	close(p_child_stdout[READ_END]);
-        }
-        else{
-        	*fd_output = p_child_stdout[READ_END];
-        }
-
-        return pid;
-    }
+	spawned_child child = spawner::spawn(_args, options);
+	spawner::reapDetached(child.pid);
 }
 
 vector<const char*> utils::getExecArgs(const string &exeName, const vector<string> &args)
@@ -325,6 +797,95 @@ void utils::strReplaceAll(string &data, const string &toSearch, const string &re
 	}
 }
 
+//returns the first character from p that has to be escaped, or end
+//clean blocks of 32 or 16 bytes are skipped with a single comparison
+static const char* findEscape(const char *p, const char *end, bool quotes)
+{
+#if defined(__AVX2__)
+	const __m256i ctl32 = _mm256_set1_epi8(0x1F);
+	const __m256i quote32 = _mm256_set1_epi8('"');
+	const __m256i bslash32 = _mm256_set1_epi8('\\');
+	while(end - p >= 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		//max(v, 0x1F) == 0x1F means v <= 0x1F as unsigned
+		__m256i m = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctl32), ctl32);
+		if(quotes)
+		{
+			m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, quote32), _mm256_cmpeq_epi8(v, bslash32)));
+		}
+		unsigned int mask = _mm256_movemask_epi8(m);
+		if(mask != 0) return p + __builtin_ctz(mask);
+		p += 32;
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i ctl16 = _mm_set1_epi8(0x1F);
+	const __m128i quote16 = _mm_set1_epi8('"');
+	const __m128i bslash16 = _mm_set1_epi8('\\');
+	while(end - p >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		__m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, ctl16), ctl16);
+		if(quotes)
+		{
+			m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, quote16), _mm_cmpeq_epi8(v, bslash16)));
+		}
+		unsigned int mask = _mm_movemask_epi8(m);
+		if(mask != 0) return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while(p < end)
+	{
+		unsigned char c = *p;
+		if(c < 0x20 || (quotes && (c == '"' || c == '\\'))) break;
+		p++;
+	}
+	return p;
+}
+
+//appends 'in' to 'out' in a single pass with the characters JSON doesn't allow raw escaped
+//with quotes=false only control characters are escaped, which is what a whole serialized message needs
+//because its quotes and backslashes are part of the JSON itself
+void utils::escapeJSON(string_view in, string &out, bool quotes)
+{
+	out.reserve(out.length() + in.length() + 16);
+
+	const char *p = in.data();
+	const char *end = p + in.length();
+	const char *clean = p;
+
+	while((p = findEscape(p, end, quotes)) != end)
+	{
+		out.append(clean, p - clean);
+
+		unsigned char c = *p;
+		switch(c)
+		{
+			case '"': out.append("\\\""); break;
+			case '\\': out.append("\\\\"); break;
+			case '\b': out.append("\\b"); break;
+			case '\f': out.append("\\f"); break;
+			case '\n': out.append("\\n"); break;
+			case '\r': out.append("\\r"); break;
+			case '\t': out.append("\\t"); break;
+			default:
+			{
+				const char *hex = "0123456789abcdef";
+				char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+				out.append(esc, 6);
+				break;
+			}
+		}
+
+		p++;
+		clean = p;
+	}
+
+	out.append(clean, end - clean);
+}
+
 vector<string> utils::strSplit(const string &str, const char delim)
 {
 	vector<string> parts;
@@ -343,8 +904,36 @@ vector<string> utils::strSplit(const string &str, const char delim)
 	return parts;
 }
 
+#ifdef GRABBY_TESTING
+//test builds don't show the dialogs when GRABBY_SAVE_DIR is set, the replay driver sets it
+//returns the directory with a / at the end, or "" when it isn't set
+static string testSaveDir()
+{
+	const char* saveDir = getenv("GRABBY_SAVE_DIR");
+	if(saveDir == NULL || saveDir[0] == '\0')
+	{
+		return "";
+	}
+
+	string dir = saveDir;
+	if(dir.back() != '/')
+	{
+		dir += '/';
+	}
+	return dir;
+}
+#endif
+
 string utils::fileSaveDialog(const string &filename)
 {
+#ifdef GRABBY_TESTING
+	string saveDir = testSaveDir();
+	if(saveDir.length() > 0)
+	{
+		return saveDir + filename;
+	}
+#endif
+
 	std::lock_guard<std::mutex> lock(guiMutex);
 
 	const char* path = tinyfd_saveFileDialog("Save file as", filename.c_str(), 0, NULL, NULL );
@@ -353,6 +942,14 @@ string utils::fileSaveDialog(const string &filename)
 
 string utils::folderOpenDialog()
 {
+#ifdef GRABBY_TESTING
+	string saveDir = testSaveDir();
+	if(saveDir.length() > 0)
+	{
+		return saveDir;
+	}
+#endif
+
 	std::lock_guard<std::mutex> lock(guiMutex);
 
 	const char* path = tinyfd_selectFolderDialog("Select folder to save files", NULL);
@@ -418,6 +1015,19 @@ string utils::trim(string str)
 	return str;
 }
 
+//same as trim but returns the part of str without the whitespace instead of a copy
+string_view utils::trimView(string_view str)
+{
+	const char* ws = " \t\n\r\f\v";
+	size_t first = str.find_first_not_of(ws);
+	if(first == string_view::npos)
+	{
+		return string_view();
+	}
+
+	return str.substr(first, str.find_last_not_of(ws) - first + 1);
+}
+
 pair<string, string> utils::getTerminalCmd()
 {
 	pair<string, string> cmd;
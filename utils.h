@@ -1,9 +1,9 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include "wintypes.h"
 #include "jsonla.h"
-#include "output_callback.h"
 #include "types.h"
 
 class utils
@@ -13,12 +13,21 @@ public:
 	utils(void);
 	~utils(void);
 	static ggicci::Json parseJSON(const std::string &JSONstr);
+	static ggicci::Json parseJSON(const char *JSONstr);
+	static ggicci::Json parseJSONInSitu(std::string_view JSONstr, const ggicci::Json &document = ggicci::Json(),
+		const ggicci::JsonFilter *filter = NULL);
 	static process_result launchExe(const std::string &exeName, const std::vector<std::string> &args,
-		const std::string &input = "", const std::string &killSwitch = "", output_callback *callback = NULL );
+		const std::string &input = "", const std::string &killSwitch = "", line_callback callback = nullptr,
+		output_retention retention = RETAIN_ALL);
+	static void launchExeAsync(const std::string &exeName, const std::vector<std::string> &args,
+		const std::string &input, const std::string &killSwitch, line_callback callback, exit_callback onExit,
+		output_retention retention = RETAIN_ALL);
+	static std::function<void()> pauseOutput();
+	static void checkKillSwitches();
 	static void execCmd(std::string &exeName, std::vector<std::string> args, bool showConsole);
-	static pid_t popen2(std::vector<const char*> args, int *fd_input, int *fd_output);
 	static std::vector<const char*> getExecArgs(const std::string &exeName, const std::vector<std::string> &args);
 	static void strReplaceAll(std::string &data, const std::string &toSearch, const std::string &replaceStr);
+	static void escapeJSON(std::string_view in, std::string &out, bool quotes = true);
 	static std::vector<std::string> strSplit(const std::string &str, const char delim);
 	static std::string fileSaveDialog(const std::string &filename);
 	static std::string folderOpenDialog();
@@ -26,6 +35,7 @@ public:
 	static std::vector<std::string> getEnvarNames();
 	static std::string strToLower(const std::string &str);
 	static std::string trim(std::string str);
+	static std::string_view trimView(std::string_view str);
 	static std::pair<std::string, std::string> getTerminalCmd();
 };
 